@@ -5,8 +5,27 @@
   It is compiled into WASM, and the run function can be executed by JavaScript.
 */
 
+#include <limits.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdint.h>
+#ifndef __wasm__
+// Native builds get a few extras (threads and so on) that the WASM build can't
+// use
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#endif
+
+// The scalar and vectorized kernels below have to round identically, so the
+// compiler isn't allowed to fuse multiply-adds on its own
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#else
+#pragma GCC optimize("fp-contract=off")
+#endif
+
 // Fast mixing (smoothing) of 32-bit colors
 static inline uint32_t mix(uint32_t colorStart, uint32_t colorEnd, uint32_t a) {
   uint32_t reverse = 0xff - a;
@@ -56,14 +75,10 @@ static inline uint32_t mix2(uint32_t colorStart, uint32_t colorEnd, float a,
   return mixBlack(color, 200 * darkenAmount);
 }
 
-// Get a smoothed, looped, index of a pallete
-uint32_t getPallete(float position, uint32_t *pallete, int length,
-                    int renderMode, float darkenAmount) {
-  // Pallete used by handlePixels (last element=first element for looping).
-  // Interestingly, you can get the hex representations with the middle six
-  // letters (#a00a0a for the first one, for example)
-  int id = (int)position % length;
-  float mod = position - ((int)position / length) * length - (float)id;
+// The color mod of the way from pallete[id] to pallete[id + 1], before it's
+// darkened
+static inline uint32_t segmentColor(const uint32_t *pallete, int id, float mod,
+                                    int renderMode) {
   if (renderMode == 1) {
     uint32_t color = mix(pallete[id], pallete[id + 1], mod * sqrtf(mod) * 255);
     // Incredibly complicated, eh?
@@ -117,10 +132,21 @@ uint32_t getPallete(float position, uint32_t *pallete, int length,
         color = newColor;
       }
     }
-    return mixBlack(color, 200 * darkenAmount);
+    return color;
   }
-  uint32_t color = mix(pallete[id], pallete[id + 1], mod * 255);
-  return mixBlack(color, 200 * darkenAmount);
+  return mix(pallete[id], pallete[id + 1], mod * 255);
+}
+
+// Get a smoothed, looped, index of a pallete
+uint32_t getPallete(float position, uint32_t *pallete, int length,
+                    int renderMode, float darkenAmount) {
+  // Pallete used by handlePixels (last element=first element for looping).
+  // Interestingly, you can get the hex representations with the middle six
+  // letters (#a00a0a for the first one, for example)
+  int id = (int)position % length;
+  float mod = position - ((int)position / length) * length - (float)id;
+  return mixBlack(segmentColor(pallete, id, mod, renderMode),
+                  200 * darkenAmount);
 }
 
 // Really efficient (wouldn't be used if wasm supported log2; reduces overhead)
@@ -162,1451 +188,4352 @@ static inline float sinq(float x) {
   return x;
 }
 
-// All the fractal functions are below! The first section has no shading, the
-// second section has directional shading, and the third section does some funky
-// weird shading that's a little hard to explain.
+// All the fractal functions are below! Each formula is just its step (one case
+// of FORMULA_STEP, plus DERIVATIVE_STEP for the ones with derivative shading)
+// and its smoothing constant. The loop around it comes in two flavors,
+// pixelLoop() for one pixel and lanesLoop() for several at once, and both take
+// the formula and the shading as constants: 0 for no shading, 1 for the
+// directional shading of darkenEffect 1 and 2, and 2 for the funky weird
+// shading of darkenEffect 3 that's a little hard to explain. Every one of the
+// 16 x 3 combinations is stamped out as its own kernel further down, so all the
+// switches inside fold away at compile time and the renderers pick a kernel
+// once per call rather than once per pixel.
+//
+// Interior pixels are the expensive ones, since they go all the way to the
+// iteration limit. Every loop watches for its orbit settling into a cycle
+// (Brent's method: remember z at each power of two and compare against it) and
+// gives up early once it has. Comparing only every 8th step is much cheaper and
+// still catches a cycle of length p by the time it's gone around 8p times. The
+// plain Mandelbrot also skips the main cardioid and the period 2 bulb outright.
+
+// How close the orbit has to come back to count as a cycle
+#define PERIOD_EPSILON 1e-13
+
+// The constant each formula multiplies its smoothing term by (1 / log2 of the
+// degree)
+static const float smoothing[16] = {
+    1.0f, 0.6309297535714575f, 0.5f, 0.43067655807339306f,
+    0.38685280723454163f, 0.3562071871080222f, 1.0f, 0.6309297535714575f,
+    0.5f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.6309297535714575f, 0.5f};
+
+// Only some formulas track the derivative for shading 1 (the others just go
+// unshaded)
+#define HAS_DERIVATIVE(type) ((type) <= 3 || ((type) >= 6 && (type) <= 8))
 
-float mand(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
+// The plain Mandelbrot has always bailed out a bit earlier than the rest
+#define BAILOUT(type, shading) ((type) == 0 && (shading) == 0 ? 500.0 : 2500.0)
+
+// One step of z -> f(z) + c. These work on doubles and vdoubles alike (abs is
+// fabs or vabs to match), and r, i and so on have to be plain variables. ship
+// says whether the burning ship part of the mbbs formulas is due.
+#define FORMULA_STEP(type, derivative, ship, abs, r, i, sr, si, x, y)         \
+  do {                                                                        \
+    switch (type) {                                                           \
+      case 0:                                                                 \
+        i = 2.0 * r * i + y;                                                  \
+        r = sr - si + x;                                                      \
+        break;                                                                \
+      case 1:                                                                 \
+        r = r * (sr - 3.0 * si) + x;                                          \
+        i = i * (3.0 * sr - si) + y;                                          \
+        break;                                                                \
+      case 2:                                                                 \
+        if (derivative) {                                                     \
+          i = 4.0 * (sr * (r * i) - r * si * i) + y;                          \
+        } else {                                                              \
+          i = 4.0 * (sr * r * i - r * si * i) + y;                            \
+        }                                                                     \
+        r = sr * (sr - 6.0 * si) + si * si + x;                               \
+        break;                                                                \
+      case 3: {                                                               \
+        __typeof__(r) fi = si * si;                                           \
+        i = i * (sr * (5.0 * sr - 10.0 * si) + fi) + y;                       \
+        r = r * (sr * (sr - 10.0 * si) + 5.0 * fi) + x;                       \
+        break;                                                                \
+      }                                                                       \
+      case 4: {                                                               \
+        __typeof__(r) fr = sr * sr;                                           \
+        __typeof__(r) fi = si * si;                                           \
+        i = r * i * (6.0 * (fr + fi) - 20.0 * sr * si) + y;                   \
+        r = sr * (fr + 15.0 * fi) - si * (15.0 * fr + fi) + x;                \
+        break;                                                                \
+      }                                                                       \
+      case 5: {                                                               \
+        __typeof__(r) fr = sr * sr;                                           \
+        __typeof__(r) fi = si * si;                                           \
+        r = r * (fr * (sr - 21.0 * si) + fi * (35.0 * sr - 7.0 * si)) + x;   \
+        i = i * (fr * (7.0 * sr - 35.0 * si) + fi * (21.0 * sr - si)) + y;    \
+        break;                                                                \
+      }                                                                       \
+      case 6:                                                                 \
+        i = abs(2.0 * r * i) + y;                                             \
+        r = sr - si + x;                                                      \
+        break;                                                                \
+      case 7:                                                                 \
+        r = abs(r) * (sr - 3.0 * si) + x;                                     \
+        i = abs(i) * (3.0 * sr - si) + y;                                     \
+        break;                                                                \
+      case 8:                                                                 \
+        i = abs(4.0 * r * i) * (sr - si) + y;                                 \
+        r = sr * sr - 6.0 * sr * si + si * si + x;                            \
+        break;                                                                \
+      case 9:                                                                 \
+        i = 2.0 * r * i + y;                                                  \
+        r = abs(sr - si) + x;                                                 \
+        break;                                                                \
+      case 10: {                                                              \
+        __typeof__(r) tr = 2.0 * r * i;                                       \
+        r = abs(sr - i * i + x);                                              \
+        i = -tr - y;                                                          \
+        break;                                                                \
+      }                                                                       \
+      case 11: {                                                              \
+        r = abs(r);                                                           \
+        i = abs(i);                                                           \
+        __typeof__(r) tr = 2.0 * r * i;                                       \
+        r = sr - si - r + x;                                                  \
+        i = tr - i + y;                                                       \
+        break;                                                                \
+      }                                                                       \
+      case 12:                                                                \
+        i = y - 2.0 * r * i;                                                  \
+        r = sr - si + x;                                                      \
+        break;                                                                \
+      case 13:                                                                \
+        if (ship) {                                                           \
+          i = abs(2.0 * r * i) + y;                                           \
+        } else {                                                              \
+          i = 2.0 * r * i + y;                                                \
+        }                                                                     \
+        r = sr - si + x;                                                      \
+        break;                                                                \
+      case 14:                                                                \
+        if (ship) {                                                           \
+          r = abs(r) * (sr - 3.0 * si) + x;                                   \
+          i = abs(i) * (3.0 * sr - si) + y;                                   \
+        } else {                                                              \
+          r = r * (sr - 3.0 * si) + x;                                        \
+          i = i * (3.0 * sr - si) + y;                                        \
+        }                                                                     \
+        break;                                                                \
+      default:                                                                \
+        if (ship) {                                                           \
+          i = abs(4.0 * r * i) * (sr - si) + y;                               \
+          r = sr * sr - 6.0 * sr * si + si * si + x;                          \
+        } else {                                                              \
+          i = 4.0 * (sr * r * i - r * si * i) + y;                            \
+          r = sr * (sr - 6.0 * si) + si * si + x;                             \
+        }                                                                     \
+    }                                                                         \
+  } while (0)
+
+// The derivative (dr, di) for the formulas with HAS_DERIVATIVE, taken before
+// the step. The burning ships share the Mandelbrot ones of the same degree. dc
+// is the derivative of c: 1 in the parameter plane and 0 for a Julia set.
+#define DERIVATIVE_STEP(type, r, i, sr, si, dr, di, dc)                       \
+  do {                                                                        \
+    __typeof__(r) tempdr;                                                     \
+    if ((type) == 0 || (type) == 6) {                                         \
+      tempdr = 2.0 * (dr * r - di * i) + dc;                                  \
+      di = 2.0 * (dr * i + di * r);                                           \
+    } else if ((type) == 1 || (type) == 7) {                                  \
+      __typeof__(r) temp = 2.0 * r * i;                                       \
+      tempdr = 3.0 * (dr * (sr - si) - di * temp) + dc;                       \
+      di = 3.0 * (dr * temp + di * (sr - si));                                \
+    } else if ((type) == 2 || (type) == 8) {                                  \
+      __typeof__(r) temp = r * i;                                             \
+      tempdr = 4.0 * (sr - si) * (dr * r - di * i) -                          \
+               8.0 * temp * (dr * i + di * r) + dc;                           \
+      di = 4.0 * (sr - si) * (dr * i + di * r) +                              \
+           8.0 * temp * (dr * r - di * i);                                    \
+    } else {                                                                  \
+      __typeof__(r) fi = si * si;                                             \
+      tempdr = 5.0 * (sr * sr - 6.0 * sr * si + fi) * dr -                    \
+               20.0 * r * i * (sr - si) * di + dc;                            \
+      di = 5.0 * (sr * sr - 6.0 * sr * si + fi) * di +                        \
+           20.0 * r * i * (sr - si) * dr;                                     \
+    }                                                                         \
+    dr = tempdr;                                                              \
+  } while (0)
+
+// Julia sets. Normally each pixel is its own c and starts from z = c, which
+// draws the parameter plane. A JuliaSet that's on switches the kernels over to
+// the Julia set of one c instead, where the pixel is just the starting z. The
+// shading then follows the derivative with respect to that z, so it loses the
+// + 1 of each step, and the cardioid test is off (it only means anything for
+// c).
+typedef struct {
+  int on;
+  double x;
+  double y;
+} JuliaSet;
+
+// What the next renders draw (see setJulia())
+static JuliaSet juliaDefault;
+
+// The smoothed count (and the shading in *ptr) of a pixel that escaped at step
+// n. This only happens once per pixel, so both loops do it one pixel at a time.
+static inline __attribute__((always_inline)) float escapePixel(
+    const int type, const int shading, int n, double r, double i, double dr,
+    double di, float *ptr) {
   double sr = r * r;
   double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = 2 * r * i + y;
-    r = sr - si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
-    }
+  float result = (float)n - (secondLog(sqrtf(sr + si))) * smoothing[type];
+  if (shading == 1 && HAS_DERIVATIVE(type)) {
+    double sqm = dr * dr + di * di;
+    double ur = (r * dr + i * di) / sqm;
+    double ui = (i * dr - r * di) / sqm;
+    double norm = sqrt(ur * ur + ui * ui);
+    ur /= norm;
+    ui /= norm;
+    float t = (ur + ui) * 0.7071067811865475f + 1.5f;
+    *ptr = t <= 0 ? 0 : (t * 0.4f);
+  } else if (shading == 2) {
+    double ur = r + i;
+    double ui = i - r;
+    double norm = sqrt(ur * ur + ui * ui);
+    ur /= norm;
+    ui /= norm;
+    float t = (ur + ui) * 0.7071067811865475f + 1.5f;
+    *ptr = t <= 0 ? 0 : t * 0.4f;
   }
-  return -999.0f;
+  return result;
 }
 
-float mand3(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
+// Iterate a single pixel. steps (if it isn't NULL) gets how many iterations
+// that really took.
+static inline __attribute__((always_inline)) float pixelLoop(
+    const int type, const int shading, int iterations,
+    const JuliaSet *juliaSet, double x, double y, float *ptr, int *steps) {
+  const int derivative = shading == 1 && HAS_DERIVATIVE(type);
+  const int julia = juliaSet->on;
+  double cx = julia ? juliaSet->x : x;
+  double cy = julia ? juliaSet->y : y;
+  double dc = julia ? 0.0 : 1.0;
+  double r = type == 10 ? fabs(x) : x;
+  double i = type == 10 ? -y : y;
   double sr = r * r;
   double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    r = r * (sr - 3.0 * si) + x;
-    i = i * (3.0 * sr - si) + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.6309297535714575f;
-      return result;
+  double dr = 1;
+  double di = 0;
+  if (type == 0 && !julia) {
+    // The main cardioid and the period 2 bulb are always interior
+    double q = (x - 0.25) * (x - 0.25) + y * y;
+    if (q * (q + (x - 0.25)) <= 0.25 * y * y ||
+        (x + 1.0) * (x + 1.0) + y * y <= 0.0625) {
+      if (steps) {
+        *steps = 0;
+      }
+      return -999.0f;
     }
   }
-  return -999.0f;
-}
-
-float mand4(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
+  double checkR = r;
+  double checkI = i;
+  int checkAt = 1;
+  int exchange = 1;
+  int checkExchange = exchange;
   for (int n = 1; n <= iterations; n++) {
-    i = 4.0 * (sr * r * i - r * si * i) + y;
-    r = sr * (sr - 6.0 * si) + si * si + x;
+    if (derivative) {
+      DERIVATIVE_STEP(type, r, i, sr, si, dr, di, dc);
+    }
+    int ship = 0;
+    if (type >= 13 && exchange++ == 10) {
+      exchange = 1;
+      ship = 1;
+    }
+    FORMULA_STEP(type, derivative, ship, fabs, r, i, sr, si, cx, cy);
     sr = r * r;
     si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si))) * 0.5f;
-      return result;
+    if (sr + si > BAILOUT(type, shading)) {
+      if (steps) {
+        *steps = n;
+      }
+      return escapePixel(type, shading, n, r, i, dr, di, ptr);
+    }
+    // The mbbs formulas only repeat when they're at the same point of their
+    // cycle of 10 steps, too
+    if ((n & 7) == 0 && (type < 13 || exchange == checkExchange) &&
+        fabs(r - checkR) + fabs(i - checkI) < PERIOD_EPSILON) {
+      if (steps) {
+        *steps = n;
+      }
+      return -999.0f;
+    }
+    if (n == checkAt) {
+      checkR = r;
+      checkI = i;
+      checkExchange = exchange;
+      checkAt *= 2;
     }
   }
+  if (steps) {
+    *steps = iterations;
+  }
   return -999.0f;
 }
 
-float mand5(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double fi = si * si;
-  for (int n = 1; n <= iterations; n++) {
-    i = i * (sr * (5.0 * sr - 10.0 * si) + fi) + y;
-    r = r * (sr * (sr - 10.0 * si) + 5.0 * fi) + x;
-    sr = r * r;
-    si = i * i;
-    fi = si * si;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.43067655807339306f;
-      return result;
-    }
+// -----
+
+// pixelLoop() iterates a single pixel at a time. lanesLoop() runs LANES
+// neighboring pixels of a row in lock-step using the compiler's generic vector
+// types, so one source compiles to SSE2, AVX2 or AVX-512 natively (picked at
+// runtime from CPUID) and to simd128 when the WASM build is given -msimd128. A
+// lane group is 8 doubles (or 16 floats) wide: that is one AVX-512 register,
+// two AVX2 registers or four SSE2/simd128 registers (which also helps hide the
+// latency of the dependency chain in each step).
+//
+// Each lane drops out as soon as its pixel escapes. Both loops run the same
+// FORMULA_STEP, so the iters, shading and colors that run() produces are
+// bit-for-bit identical whichever one a pixel goes through (a tolerance of
+// zero). That only holds because contraction is turned off at the top of the
+// file: with fused multiply-adds (which AVX-512 implies) pixels right on the
+// boundary can escape a few iterations apart.
+
+#define LANES 8
+// The float kernels (see below) fit twice as many in the same registers
+#define FLOAT_LANES 16
+
+typedef double vdouble __attribute__((vector_size(LANES * sizeof(double))));
+typedef int64_t vlong __attribute__((vector_size(LANES * sizeof(double))));
+typedef float vsingle
+    __attribute__((vector_size(FLOAT_LANES * sizeof(float))));
+typedef int32_t vsingleMask
+    __attribute__((vector_size(FLOAT_LANES * sizeof(float))));
+
+// Branch-free helpers (macros, so no vector ever crosses a call boundary)
+#define vabs(x) ((vdouble)((vlong)(x) & 0x7fffffffffffffffLL))
+#define vabsSingle(x) ((vsingle)((vsingleMask)(x) & 0x7fffffff))
+#define vselect(mask, a, b)                           \
+  ((__typeof__(a))(((__typeof__(mask))(a) & (mask)) | \
+                   ((__typeof__(mask))(b) & ~(mask))))
+
+static inline __attribute__((always_inline)) int anyLane(vlong mask) {
+  int64_t any = 0;
+  for (int k = 0; k < LANES; k++) {
+    any |= mask[k];
   }
-  return -999.0f;
+  return any != 0;
 }
 
-float mand6(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double fr = sr * sr;
-  double fi = si * si;
-  for (int n = 1; n <= iterations; n++) {
-    i = r * i * (6.0 * (fr + fi) - 20.0 * sr * si) + y;
-    r = sr * (fr + 15.0 * fi) - si * (15.0 * fr + fi) + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.38685280723454163f;
-      return result;
-    }
-    fr = sr * sr;
-    fi = si * si;
-  }
-  return -999.0f;
+// (The float masks are the same size, so they can be checked 64 bits at a
+// time)
+#define anySingleLane(mask) anyLane((vlong)(mask))
+
+// Iterate count (up to width) points (xs[k], ys[k]), usually neighboring
+// pixels of a row (steps works like in pixelLoop()). It's a macro so the same
+// loop comes in doubles and in floats: real and vreal are the number and vector
+// types, vmask the matching integer vector, abs and any the helpers for them.
+#define LANES_LOOP(name, real, vreal, vmask, width, abs, any)                \
+static inline __attribute__((always_inline)) void name(                       \
+    const int type, const int shading, int iterations,                        \
+    const JuliaSet *juliaSet, const double *xs, const double *xsLow,          \
+    const double *ys, const double *ysLow, int count, float *out,             \
+    float *shade, int *steps) {                                               \
+  /* (The low halves are only there to match ddLanesLoop()) */                \
+  (void)xsLow;                                                                \
+  (void)ysLow;                                                                \
+  const int derivative = shading == 1 && HAS_DERIVATIVE(type);                \
+  vreal x;                                                                    \
+  vreal vy;                                                                   \
+  for (int k = 0; k < width; k++) {                                           \
+    x[k] = xs[k < count ? k : count - 1];                                     \
+    vy[k] = ys[k < count ? k : count - 1];                                    \
+  }                                                                           \
+  const int julia = juliaSet->on;                                             \
+  vreal cx = julia ? (vreal){0} + (real)juliaSet->x : x;                      \
+  vreal cy = julia ? (vreal){0} + (real)juliaSet->y : vy;                     \
+  real dc = julia ? 0 : 1;                                                    \
+  vreal r = type == 10 ? abs(x) : x;                                          \
+  vreal i = type == 10 ? -vy : vy;                                            \
+  vreal sr = r * r;                                                           \
+  vreal si = i * i;                                                           \
+  vreal dr = (vreal){0} + 1.0;                                                \
+  vreal di = (vreal){0};                                                      \
+  vreal er = r, ei = i, edr = dr, edi = di;                                   \
+  vmask active = (vmask){0} - 1;                                              \
+  vmask escapedAt = (vmask){0};                                               \
+  int exchange = 1;                                                           \
+  if (type == 0 && !julia) {                                                  \
+    /* The main cardioid and the period 2 bulb are always interior */         \
+    vreal q = (x - 0.25) * (x - 0.25) + vy * vy;                              \
+    active &= ~((q * (q + (x - 0.25)) <= 0.25 * vy * vy) |                    \
+                ((x + 1.0) * (x + 1.0) + vy * vy <= 0.0625));                 \
+  }                                                                           \
+  /* When each lane stopped, if it didn't escape (only kept when it's         \
+     wanted) */                                                               \
+  int stoppedAt[width];                                                       \
+  if (steps) {                                                                \
+    for (int k = 0; k < width; k++) {                                         \
+      stoppedAt[k] = active[k] ? iterations : 0;                              \
+    }                                                                         \
+  }                                                                           \
+  if (!any(active)) {                                                         \
+    iterations = 0;                                                           \
+  }                                                                           \
+  vreal checkR = r;                                                           \
+  vreal checkI = i;                                                           \
+  int checkAt = 1;                                                            \
+  int checkExchange = exchange;                                               \
+  for (int n = 1; n <= iterations; n++) {                                     \
+    if (derivative) {                                                         \
+      DERIVATIVE_STEP(type, r, i, sr, si, dr, di, dc);                        \
+    }                                                                         \
+    int ship = 0;                                                             \
+    if (type >= 13 && exchange++ == 10) {                                     \
+      exchange = 1;                                                           \
+      ship = 1;                                                               \
+    }                                                                         \
+    FORMULA_STEP(type, derivative, ship, abs, r, i, sr, si, cx, cy);          \
+    sr = r * r;                                                               \
+    si = i * i;                                                               \
+    vmask escaped = (sr + si > (real)BAILOUT(type, shading)) & active;        \
+    if (any(escaped)) {                                                       \
+      /* Freeze the lanes that just escaped; the others keep going */         \
+      er = vselect(escaped, r, er);                                           \
+      ei = vselect(escaped, i, ei);                                           \
+      if (derivative) {                                                       \
+        edr = vselect(escaped, dr, edr);                                      \
+        edi = vselect(escaped, di, edi);                                      \
+      }                                                                       \
+      escapedAt = (escapedAt & ~escaped) | (((vmask){0} + n) & escaped);      \
+      active &= ~escaped;                                                     \
+      if (!any(active)) {                                                     \
+        break;                                                                \
+      }                                                                       \
+    }                                                                         \
+    /* Lanes that have gone around a cycle are interior, so they just stop */ \
+    if ((n & 7) == 0 && (type < 13 || exchange == checkExchange)) {           \
+      vmask cycled = (abs(r - checkR) + abs(i - checkI) <                     \
+                     (real)PERIOD_EPSILON) &                                  \
+                    active;                                                   \
+      if (any(cycled)) {                                                      \
+        for (int k = 0; k < width && steps; k++) {                            \
+          stoppedAt[k] = cycled[k] ? n : stoppedAt[k];                        \
+        }                                                                     \
+        active &= ~cycled;                                                    \
+        if (!any(active)) {                                                   \
+          break;                                                              \
+        }                                                                     \
+      }                                                                       \
+    }                                                                         \
+    if (n == checkAt) {                                                       \
+      checkR = r;                                                             \
+      checkI = i;                                                             \
+      checkExchange = exchange;                                               \
+      checkAt *= 2;                                                           \
+    }                                                                         \
+  }                                                                           \
+                                                                              \
+  for (int k = 0; k < count; k++) {                                           \
+    out[k] = escapedAt[k] ? escapePixel(type, shading, escapedAt[k], er[k],   \
+                                        ei[k], edr[k], edi[k], shade + k)     \
+                          : -999.0f;                                          \
+    if (steps) {                                                              \
+      steps[k] = escapedAt[k] ? escapedAt[k] : stoppedAt[k];                  \
+    }                                                                         \
+  }                                                                           \
 }
 
-float mand7(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double fr = sr * sr;
-  double fi = si * si;
-  for (int n = 1; n <= iterations; n++) {
-    r = r * (fr * (sr - 21.0 * si) + fi * (35.0 * sr - 7.0 * si)) + x;
-    i = i * (fr * (7.0 * sr - 35.0 * si) + fi * (21.0 * sr - si)) + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.3562071871080222f;
-      return result;
-    }
-    fr = sr * sr;
-    fi = si * si;
-  }
-  return -999.0f;
+LANES_LOOP(lanesLoop, double, vdouble, vlong, LANES, vabs, anyLane)
+LANES_LOOP(floatLanesLoop, float, vsingle, vsingleMask, FLOAT_LANES,
+           vabsSingle, anySingleLane)
+
+// -----
+
+// Double-double. Past about 1e-13 (see precisionOf()) doubles can't tell the
+// pixels apart either, so there's a third family of lane kernels that keeps
+// every number as the unevaluated sum of two doubles, hi + lo, for about 106
+// bits. That's good down to around 1e-28, past which runDeep()'s perturbation
+// is the thing to use. Each step is the same formula as FORMULA_STEP, written
+// out with the functions below (there's no operator overloading in C), and the
+// derivative for shading stays in plain doubles since it only has to point the
+// right way. It's all branch-free. The products use Dekker's split rather than
+// fused multiply-adds: contraction is off for the whole file, WASM has no fma,
+// and this way one source still compiles for every instruction set.
+//
+// run() only gets posX and posY as doubles, so setPositionLow() takes what's
+// left over to place a deep view exactly.
+
+typedef struct {
+  vdouble hi;
+  vdouble lo;
+} vdd;
+
+static double positionLowX;
+static double positionLowY;
+
+// The low halves of the position for the next frames (posX + x and posY + y
+// is the real position), or 0 for none
+extern void setPositionLow(double x, double y) {
+  positionLowX = x;
+  positionLowY = y;
 }
 
-float ship(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = fabs(2.0 * r * i) + y;
-    r = sr - si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
-    }
-  }
-  return -999.0f;
+// The low half of a + b, given their rounded sum, plus low
+static inline double lowPart(double a, double b, double sum, double low) {
+  double v = sum - a;
+  return (a - (sum - v)) + (b - v) + low;
 }
 
-float ship3(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    r = fabs(r) * (sr - 3.0 * si) + x;
-    i = fabs(i) * (3.0 * sr - si) + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.6309297535714575f;
-      return result;
-    }
-  }
-  return -999.0f;
+// How close the orbit has to come back to count as a cycle, in double-double
+#define DD_PERIOD_EPSILON 1e-30
+
+static inline __attribute__((always_inline)) vdd ddFromDouble(vdouble a) {
+  return (vdd){a, (vdouble){0}};
 }
 
-float ship4(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = fabs(4.0 * r * i) * (sr - si) + y;
-    r = sr * sr - 6.0 * sr * si + si * si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si))) * 0.5f;
-      return result;
-    }
-  }
-  return -999.0f;
+// a + b with the rounding error in lo (exact)
+static inline __attribute__((always_inline)) vdd ddTwoSum(vdouble a,
+                                                        vdouble b) {
+  vdouble s = a + b;
+  vdouble v = s - a;
+  return (vdd){s, (a - (s - v)) + (b - v)};
 }
 
-float celt(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = 2.0 * r * i + y;
-    r = fabs(sr - si) + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
-    }
-  }
-  return -999.0f;
+// The same when |a| >= |b|
+static inline __attribute__((always_inline)) vdd ddQuickTwoSum(vdouble a,
+                                                             vdouble b) {
+  vdouble s = a + b;
+  return (vdd){s, b - (s - a)};
 }
 
-float prmb(int iterations, double x, double y) {
-  double r = fabs(x);
-  double i = -y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    double tr = 2.0 * r * i;
-    r = fabs(sr - i * i + x);
-    i = -tr - y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
-    }
-  }
-  return -999.0f;
+// a * b with the rounding error in lo (exact, by splitting both into 26 bit
+// halves)
+static inline __attribute__((always_inline)) vdd ddTwoProduct(vdouble a,
+                                                            vdouble b) {
+  vdouble p = a * b;
+  vdouble ta = 134217729.0 * a;
+  vdouble ah = ta - (ta - a);
+  vdouble al = a - ah;
+  vdouble tb = 134217729.0 * b;
+  vdouble bh = tb - (tb - b);
+  vdouble bl = b - bh;
+  return (vdd){p, ((ah * bh - p) + ah * bl + al * bh) + al * bl};
 }
 
-float buff(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    r = fabs(r);
-    i = fabs(i);
-    double tr = 2.0 * r * i;
-    r = sr - si - r + x;
-    i = tr - i + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
-    }
-  }
-  return -999.0f;
+static inline __attribute__((always_inline)) vdd ddAdd(vdd a, vdd b) {
+  vdd s = ddTwoSum(a.hi, b.hi);
+  return ddQuickTwoSum(s.hi, s.lo + (a.lo + b.lo));
 }
 
-float tric(int iterations, double x, double y) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = -2.0 * r * i + y;
-    r = sr - si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
-    }
-  }
-  return -999.0f;
+static inline __attribute__((always_inline)) vdd ddNeg(vdd a) {
+  return (vdd){-a.hi, -a.lo};
 }
 
-float mbbs(int iterations, double x, double y) {
-  int exchange = 1;
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    if (exchange++ == 10) {
-      exchange = 1;
-      i = fabs(2.0 * r * i) + y;
-      r = sr - si + x;
-    } else {
-      i = 2.0 * r * i + y;
-      r = sr - si + x;
+static inline __attribute__((always_inline)) vdd ddSub(vdd a, vdd b) {
+  return ddAdd(a, ddNeg(b));
+}
+
+static inline __attribute__((always_inline)) vdd ddMul(vdd a, vdd b) {
+  vdd p = ddTwoProduct(a.hi, b.hi);
+  return ddQuickTwoSum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+}
+
+// a * k for a small whole number k (exact when it's a power of two)
+static inline __attribute__((always_inline)) vdd ddScale(vdd a, double k) {
+  vdd p = ddTwoProduct(a.hi, (vdouble){0} + k);
+  return ddQuickTwoSum(p.hi, p.lo + a.lo * k);
+}
+
+static inline __attribute__((always_inline)) vdd ddAbs(vdd a) {
+  vlong negative = a.hi < 0.0;
+  return (vdd){vselect(negative, -a.hi, a.hi), vselect(negative, -a.lo, a.lo)};
+}
+
+// One step of z -> f(z) + c, the same as FORMULA_STEP
+static inline __attribute__((always_inline)) void ddFormulaStep(
+    const int type, int ship, vdd *pr, vdd *pi, vdd sr, vdd si, vdd x, vdd y) {
+  vdd r = *pr;
+  vdd i = *pi;
+  switch (type) {
+    case 0:
+    case 12:
+    case 13: {
+      vdd ri = ddScale(ddMul(r, i), 2.0);
+      if (type == 12) {
+        i = ddSub(y, ri);
+      } else {
+        i = ddAdd(type == 13 && ship ? ddAbs(ri) : ri, y);
+      }
+      r = ddAdd(ddSub(sr, si), x);
+      break;
     }
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
+    case 1:
+    case 7:
+    case 14: {
+      int abs = type == 7 || (type == 14 && ship);
+      vdd a = abs ? ddAbs(r) : r;
+      vdd b = abs ? ddAbs(i) : i;
+      r = ddAdd(ddMul(a, ddSub(sr, ddScale(si, 3.0))), x);
+      i = ddAdd(ddMul(b, ddSub(ddScale(sr, 3.0), si)), y);
+      break;
+    }
+    case 2:
+    case 8:
+    case 15: {
+      vdd ri = ddScale(ddMul(r, i), 4.0);
+      if (type == 8 || (type == 15 && ship)) {
+        i = ddAdd(ddMul(ddAbs(ri), ddSub(sr, si)), y);
+      } else {
+        i = ddAdd(ddMul(ri, ddSub(sr, si)), y);
+      }
+      r = ddAdd(ddAdd(ddMul(sr, ddSub(sr, ddScale(si, 6.0))), ddMul(si, si)),
+                x);
+      break;
+    }
+    case 3: {
+      vdd fi = ddMul(si, si);
+      vdd a = ddSub(ddScale(sr, 5.0), ddScale(si, 10.0));
+      vdd b = ddSub(sr, ddScale(si, 10.0));
+      i = ddAdd(ddMul(i, ddAdd(ddMul(sr, a), fi)), y);
+      r = ddAdd(ddMul(r, ddAdd(ddMul(sr, b), ddScale(fi, 5.0))), x);
+      break;
+    }
+    case 4: {
+      vdd fr = ddMul(sr, sr);
+      vdd fi = ddMul(si, si);
+      vdd a = ddSub(ddScale(ddAdd(fr, fi), 6.0), ddScale(ddMul(sr, si), 20.0));
+      i = ddAdd(ddMul(ddMul(r, i), a), y);
+      r = ddAdd(ddSub(ddMul(sr, ddAdd(fr, ddScale(fi, 15.0))),
+                      ddMul(si, ddAdd(ddScale(fr, 15.0), fi))),
+                x);
+      break;
+    }
+    case 5: {
+      vdd fr = ddMul(sr, sr);
+      vdd fi = ddMul(si, si);
+      vdd a = ddAdd(ddMul(fr, ddSub(sr, ddScale(si, 21.0))),
+                    ddMul(fi, ddSub(ddScale(sr, 35.0), ddScale(si, 7.0))));
+      vdd b = ddAdd(ddMul(fr, ddSub(ddScale(sr, 7.0), ddScale(si, 35.0))),
+                    ddMul(fi, ddSub(ddScale(sr, 21.0), si)));
+      r = ddAdd(ddMul(r, a), x);
+      i = ddAdd(ddMul(i, b), y);
+      break;
+    }
+    case 6:
+      i = ddAdd(ddAbs(ddScale(ddMul(r, i), 2.0)), y);
+      r = ddAdd(ddSub(sr, si), x);
+      break;
+    case 9:
+      i = ddAdd(ddScale(ddMul(r, i), 2.0), y);
+      r = ddAdd(ddAbs(ddSub(sr, si)), x);
+      break;
+    case 10: {
+      vdd tr = ddScale(ddMul(r, i), 2.0);
+      r = ddAbs(ddAdd(ddSub(sr, ddMul(i, i)), x));
+      i = ddSub(ddNeg(tr), y);
+      break;
+    }
+    default: {
+      r = ddAbs(r);
+      i = ddAbs(i);
+      vdd tr = ddScale(ddMul(r, i), 2.0);
+      r = ddAdd(ddSub(ddSub(sr, si), r), x);
+      i = ddAdd(ddSub(tr, i), y);
     }
   }
-  return -999.0f;
+  *pr = r;
+  *pi = i;
 }
 
-float mbbs3(int iterations, double x, double y) {
+// lanesLoop() in double-double. The starting point of each lane is
+// (xs + xsLow, ys + ysLow).
+static inline __attribute__((always_inline)) void ddLanesLoop(
+    const int type, const int shading, int iterations,
+    const JuliaSet *juliaSet, const double *xs, const double *xsLow,
+    const double *ys, const double *ysLow, int count, float *out, float *shade,
+    int *steps) {
+  const int derivative = shading == 1 && HAS_DERIVATIVE(type);
+  vdd x;
+  vdd vy;
+  for (int k = 0; k < LANES; k++) {
+    int from = k < count ? k : count - 1;
+    x.hi[k] = xs[from];
+    x.lo[k] = xsLow[from];
+    vy.hi[k] = ys[from];
+    vy.lo[k] = ysLow[from];
+  }
+  const int julia = juliaSet->on;
+  vdd cx = julia ? (vdd){(vdouble){0} + juliaSet->x, (vdouble){0}} : x;
+  vdd cy = julia ? (vdd){(vdouble){0} + juliaSet->y, (vdouble){0}} : vy;
+  double dc = julia ? 0.0 : 1.0;
+  vdd r = type == 10 ? ddAbs(x) : x;
+  vdd i = type == 10 ? ddNeg(vy) : vy;
+  vdd sr = ddMul(r, r);
+  vdd si = ddMul(i, i);
+  vdouble dr = (vdouble){0} + 1.0;
+  vdouble di = (vdouble){0};
+  vdouble er = r.hi, ei = i.hi, edr = dr, edi = di;
+  vlong active = (vlong){0} - 1;
+  vlong escapedAt = (vlong){0};
   int exchange = 1;
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
+  if (type == 0 && !julia) {
+    // The main cardioid and the period 2 bulb are always interior (doubles
+    // are plenty for that)
+    vdouble q = (x.hi - 0.25) * (x.hi - 0.25) + vy.hi * vy.hi;
+    active &= ~((q * (q + (x.hi - 0.25)) <= 0.25 * vy.hi * vy.hi) |
+                ((x.hi + 1.0) * (x.hi + 1.0) + vy.hi * vy.hi <= 0.0625));
+  }
+  int stoppedAt[LANES];
+  if (steps) {
+    for (int k = 0; k < LANES; k++) {
+      stoppedAt[k] = active[k] ? iterations : 0;
+    }
+  }
+  if (!anyLane(active)) {
+    iterations = 0;
+  }
+  vdd checkR = r;
+  vdd checkI = i;
+  int checkAt = 1;
+  int checkExchange = exchange;
   for (int n = 1; n <= iterations; n++) {
-    if (exchange++ == 10) {
+    if (derivative) {
+      vdouble rh = r.hi, ih = i.hi, srh = sr.hi, sih = si.hi;
+      DERIVATIVE_STEP(type, rh, ih, srh, sih, dr, di, dc);
+    }
+    int ship = 0;
+    if (type >= 13 && exchange++ == 10) {
       exchange = 1;
-      r = fabs(r) * (sr - 3.0 * si) + x;
-      i = fabs(i) * (3.0 * sr - si) + y;
-    } else {
-      r = r * (sr - 3.0 * si) + x;
-      i = i * (3.0 * sr - si) + y;
+      ship = 1;
     }
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.6309297535714575f;
-      return result;
+    ddFormulaStep(type, ship, &r, &i, sr, si, cx, cy);
+    sr = ddMul(r, r);
+    si = ddMul(i, i);
+    vlong escaped = (sr.hi + si.hi > BAILOUT(type, shading)) & active;
+    if (anyLane(escaped)) {
+      er = vselect(escaped, r.hi, er);
+      ei = vselect(escaped, i.hi, ei);
+      if (derivative) {
+        edr = vselect(escaped, dr, edr);
+        edi = vselect(escaped, di, edi);
+      }
+      escapedAt = (escapedAt & ~escaped) | (((vlong){0} + n) & escaped);
+      active &= ~escaped;
+      if (!anyLane(active)) {
+        break;
+      }
+    }
+    if ((n & 7) == 0 && (type < 13 || exchange == checkExchange)) {
+      vdouble distance =
+          vabs((r.hi - checkR.hi) + (r.lo - checkR.lo)) +
+          vabs((i.hi - checkI.hi) + (i.lo - checkI.lo));
+      vlong cycled = (distance < DD_PERIOD_EPSILON) & active;
+      if (anyLane(cycled)) {
+        for (int k = 0; k < LANES && steps; k++) {
+          stoppedAt[k] = cycled[k] ? n : stoppedAt[k];
+        }
+        active &= ~cycled;
+        if (!anyLane(active)) {
+          break;
+        }
+      }
+    }
+    if (n == checkAt) {
+      checkR = r;
+      checkI = i;
+      checkExchange = exchange;
+      checkAt *= 2;
     }
   }
-  return -999.0f;
-}
 
-float mbbs4(int iterations, double x, double y) {
-  int exchange = 1;
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    if (exchange++ == 10) {
-      exchange = 1;
-      i = fabs(4.0 * r * i) * (sr - si) + y;
-      r = sr * sr - 6.0 * sr * si + si * si + x;
-    } else {
-      i = 4.0 * (sr * r * i - r * si * i) + y;
-      r = sr * (sr - 6.0 * si) + si * si + x;
-    }
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si))) * 0.5f;
-      return result;
+  for (int k = 0; k < count; k++) {
+    out[k] = escapedAt[k] ? escapePixel(type, shading, escapedAt[k], er[k],
+                                        ei[k], edr[k], edi[k], shade + k)
+                          : -999.0f;
+    if (steps) {
+      steps[k] = escapedAt[k] ? escapedAt[k] : stoppedAt[k];
     }
   }
-  return -999.0f;
 }
 
 // -----
 
-float mandS(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double dr = 1;
-  double di = 0;
-  for (int n = 1; n <= iterations; n++) {
-    double tempdr = 2.0 * (dr * r - di * i) + 1.0;
-    di = 2.0 * (dr * i + di * r);
-    dr = tempdr;
-    i = 2 * r * i + y;
-    r = sr - si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      double sqm = dr * dr + di * di;
-      double ur = (r * dr + i * di) / sqm;
-      double ui = (i * dr - r * di) / sqm;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : (t * 0.4f);
-      return result;
-    }
+// The kernels themselves. EACH_TYPE(X, shading) calls X(type, shading) for all
+// 16 formulas, and EACH_KERNEL(X) does that for all 3 shading modes, which
+// gives every combination its own copy of pixelLoop() and lanesLoop() (the
+// latter once per instruction set). Tables of them are indexed [shading][type].
+
+#define EACH_TYPE(X, shading)                                                 \
+  X(0, shading) X(1, shading) X(2, shading) X(3, shading) X(4, shading)       \
+  X(5, shading) X(6, shading) X(7, shading) X(8, shading) X(9, shading)       \
+  X(10, shading) X(11, shading) X(12, shading) X(13, shading) X(14, shading)  \
+  X(15, shading)
+#define EACH_KERNEL(X) EACH_TYPE(X, 0) EACH_TYPE(X, 1) EACH_TYPE(X, 2)
+#define KERNEL_TABLE(X) \
+  {{EACH_TYPE(X, 0)}, {EACH_TYPE(X, 1)}, {EACH_TYPE(X, 2)}}
+
+typedef float (*PixelKernel)(int iterations, const JuliaSet *juliaSet,
+                             double x, double y, float *ptr, int *steps);
+typedef void (*LaneKernel)(int iterations, const JuliaSet *juliaSet,
+                           const double *xs, const double *xsLow,
+                           const double *ys, const double *ysLow, int count,
+                           float *out, float *shade, int *steps);
+
+#define PIXEL_KERNEL(type, shading)                                        \
+  static float pixel##type##_##shading(int iterations,                     \
+                                       const JuliaSet *juliaSet, double x, \
+                                       double y, float *ptr, int *steps) { \
+    return pixelLoop(type, shading, iterations, juliaSet, x, y, ptr,       \
+                     steps);                                               \
   }
-  return -999.0f;
-}
+#define PIXEL_ENTRY(type, shading) pixel##type##_##shading,
 
-float mand3S(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double dr = 1;
-  double di = 0;
-  for (int n = 1; n <= iterations; n++) {
-    double temp = 2.0 * r * i;
-    double tempdr = 3.0 * (dr * (sr - si) - di * temp) + 1.0;
-    di = 3.0 * (dr * temp + di * (sr - si));
-    dr = tempdr;
-    r = r * (sr - 3.0 * si) + x;
-    i = i * (3.0 * sr - si) + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.6309297535714575f;
-      double sqm = dr * dr + di * di;
-      double ur = (r * dr + i * di) / sqm;
-      double ui = (i * dr - r * di) / sqm;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : (t * 0.4f);
-      return result;
-    }
+EACH_KERNEL(PIXEL_KERNEL)
+static const PixelKernel pixelKernels[3][16] = KERNEL_TABLE(PIXEL_ENTRY);
+
+#define LANE_KERNEL(loop, prefix, target, type, shading)                   \
+  target static void prefix##type##_##shading(                            \
+      int iterations, const JuliaSet *juliaSet, const double *xs,         \
+      const double *xsLow, const double *ys, const double *ysLow,         \
+      int count, float *out, float *shade, int *steps) {                  \
+    loop(type, shading, iterations, juliaSet, xs, xsLow, ys, ysLow,       \
+         count, out, shade, steps);                                       \
   }
-  return -999.0f;
+
+// Lane kernel tables are indexed [precision][shading][type]: floats, doubles
+// and double-doubles
+#define LANE_DEFAULT(type, shading) \
+  LANE_KERNEL(lanesLoop, lanes, , type, shading)
+#define LANE_DEFAULT_ENTRY(type, shading) lanes##type##_##shading,
+#define FLOAT_DEFAULT(type, shading) \
+  LANE_KERNEL(floatLanesLoop, floats, , type, shading)
+#define FLOAT_DEFAULT_ENTRY(type, shading) floats##type##_##shading,
+#define DD_DEFAULT(type, shading) \
+  LANE_KERNEL(ddLanesLoop, doubleDoubles, , type, shading)
+#define DD_DEFAULT_ENTRY(type, shading) doubleDoubles##type##_##shading,
+
+EACH_KERNEL(LANE_DEFAULT)
+EACH_KERNEL(FLOAT_DEFAULT)
+EACH_KERNEL(DD_DEFAULT)
+static const LaneKernel lanesDefault[3][3][16] = {
+    KERNEL_TABLE(FLOAT_DEFAULT_ENTRY), KERNEL_TABLE(LANE_DEFAULT_ENTRY),
+    KERNEL_TABLE(DD_DEFAULT_ENTRY)};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AVX2 __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f")))
+#define LANE_AVX2(type, shading) \
+  LANE_KERNEL(lanesLoop, lanesAvx2_, AVX2, type, shading)
+#define LANE_AVX2_ENTRY(type, shading) lanesAvx2_##type##_##shading,
+#define LANE_AVX512(type, shading) \
+  LANE_KERNEL(lanesLoop, lanesAvx512_, AVX512, type, shading)
+#define LANE_AVX512_ENTRY(type, shading) lanesAvx512_##type##_##shading,
+#define FLOAT_AVX2(type, shading) \
+  LANE_KERNEL(floatLanesLoop, floatsAvx2_, AVX2, type, shading)
+#define FLOAT_AVX2_ENTRY(type, shading) floatsAvx2_##type##_##shading,
+#define FLOAT_AVX512(type, shading) \
+  LANE_KERNEL(floatLanesLoop, floatsAvx512_, AVX512, type, shading)
+#define FLOAT_AVX512_ENTRY(type, shading) floatsAvx512_##type##_##shading,
+#define DD_AVX2(type, shading) \
+  LANE_KERNEL(ddLanesLoop, doubleDoublesAvx2_, AVX2, type, shading)
+#define DD_AVX2_ENTRY(type, shading) doubleDoublesAvx2_##type##_##shading,
+#define DD_AVX512(type, shading) \
+  LANE_KERNEL(ddLanesLoop, doubleDoublesAvx512_, AVX512, type, shading)
+#define DD_AVX512_ENTRY(type, shading) doubleDoublesAvx512_##type##_##shading,
+
+EACH_KERNEL(LANE_AVX2)
+EACH_KERNEL(LANE_AVX512)
+EACH_KERNEL(FLOAT_AVX2)
+EACH_KERNEL(FLOAT_AVX512)
+EACH_KERNEL(DD_AVX2)
+EACH_KERNEL(DD_AVX512)
+static const LaneKernel lanesAvx2[3][3][16] = {
+    KERNEL_TABLE(FLOAT_AVX2_ENTRY), KERNEL_TABLE(LANE_AVX2_ENTRY),
+    KERNEL_TABLE(DD_AVX2_ENTRY)};
+static const LaneKernel lanesAvx512[3][3][16] = {
+    KERNEL_TABLE(FLOAT_AVX512_ENTRY), KERNEL_TABLE(LANE_AVX512_ENTRY),
+    KERNEL_TABLE(DD_AVX512_ENTRY)};
+#endif
+
+// Pick the widest kernels the CPU supports (the WASM build always uses the
+// default ones, which are simd128 when compiled with -msimd128)
+static const LaneKernel (*pickLaneKernels(void))[3][16] {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return lanesAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return lanesAvx2;
+  }
+#endif
+  return lanesDefault;
 }
 
-float mand4S(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double dr = 1;
-  double di = 0;
-  for (int n = 1; n <= iterations; n++) {
-    // Calculate the derivative for 4th power
-    double temp = r * i;
-    double tempdr = 4.0 * (sr - si) * (dr * r - di * i) -
-                    8.0 * temp * (dr * i + di * r) + 1.0;
-    di = 4.0 * (sr - si) * (dr * i + di * r) + 8.0 * temp * (dr * r - di * i);
-    dr = tempdr;
-    i = 4.0 * (sr * temp - r * si * i) + y;
-    r = sr * (sr - 6.0 * si) + si * si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si))) * 0.5f;
-      double sqm = dr * dr + di * di;
-      double ur = (r * dr + i * di) / sqm;
-      double ui = (i * dr - r * di) / sqm;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : (t * 0.4f);
-      return result;
+static const LaneKernel (*laneKernels)[3][16];
+
+// Which shading mode a darken effect uses
+static inline int shadingOf(int darkenEffect) {
+  return darkenEffect == 0 ? 0 : darkenEffect == 3 ? 2 : 1;
+}
+
+// The single pixel functions older versions of the viewer called directly,
+// named by formula (S for darkenEffect 1 and 2, S2 for darkenEffect 3)
+#define NAMED_KERNELS(name, type)                                          \
+  float name(int iterations, double x, double y) {                         \
+    return pixel##type##_0(iterations, &juliaDefault, x, y, 0, 0);         \
+  }                                                                        \
+  float name##S(int iterations, double x, double y, float *ptr) {          \
+    return pixel##type##_1(iterations, &juliaDefault, x, y, ptr, 0);       \
+  }                                                                        \
+  float name##S2(int iterations, double x, double y, float *ptr) {         \
+    return pixel##type##_2(iterations, &juliaDefault, x, y, ptr, 0);       \
+  }
+
+NAMED_KERNELS(mand, 0)
+NAMED_KERNELS(mand3, 1)
+NAMED_KERNELS(mand4, 2)
+NAMED_KERNELS(mand5, 3)
+NAMED_KERNELS(mand6, 4)
+NAMED_KERNELS(mand7, 5)
+NAMED_KERNELS(ship, 6)
+NAMED_KERNELS(ship3, 7)
+NAMED_KERNELS(ship4, 8)
+NAMED_KERNELS(celt, 9)
+NAMED_KERNELS(prmb, 10)
+NAMED_KERNELS(buff, 11)
+NAMED_KERNELS(tric, 12)
+NAMED_KERNELS(mbbs, 13)
+NAMED_KERNELS(mbbs3, 14)
+NAMED_KERNELS(mbbs4, 15)
+
+// -----
+
+// Render statistics, for seeing where the time goes on real views (and tuning
+// the iteration limit and the budget). They're off unless setRenderStats() has
+// been handed a RenderStats; from then on every render adds its numbers to it,
+// so a frame that takes several calls to run() adds up. Zero it (apart from
+// cost) to start over, and hand setRenderStats() NULL to turn them off again.
+// Keeping count is cheap, but timing the kernels isn't free.
+
+// How many bins the escape histogram has
+#define STATS_BINS 64
+
+typedef struct {
+  // Pixels that were iterated (not the ones already in iters), by how they
+  // ended
+  long long escaped;
+  long long interior;
+  // Iterations that were really done (the cycle check and the bulb test let
+  // interior pixels stop early, and runDeep() counts the iterations its series
+  // approximation skips)
+  long long iterations;
+  // What was charged against the budget
+  long long score;
+  // Escaped pixels by the iteration they escaped at, in STATS_BINS equal bins
+  // from 0 to the iteration limit
+  long long histogram[STATS_BINS];
+  // Time spent in the formula code, and in everything else (mostly coloring).
+  // WASM has no clock, so these stay 0 there.
+  long long formulaNanoseconds;
+  long long colorNanoseconds;
+  // Optional: w * h iteration counts, set for every pixel that gets iterated
+  // (statsHeatmap() turns them into an image)
+  uint32_t *cost;
+} RenderStats;
+
+static RenderStats *renderStats;
+
+extern void setRenderStats(RenderStats *stats) { renderStats = stats; }
+
+static inline long long statsClock(void) {
+#ifdef __wasm__
+  return 0;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+#endif
+}
+
+// Count a pixel that was just iterated (n is what the kernel returned)
+static inline void tallyPixel(RenderStats *tally, uint32_t *cost, int index,
+                              float n, int steps, int iterations) {
+  tally->iterations += steps;
+  if (n == -999.0f) {
+    tally->interior++;
+  } else {
+    tally->escaped++;
+    tally->histogram[(long long)steps * STATS_BINS / (iterations + 1)]++;
+  }
+  if (cost) {
+    cost[index] = steps;
+  }
+}
+
+// Add a tally to the stats. Native builds can have several threads doing this
+// at once, so it's atomic.
+static void mergeStats(RenderStats *stats, const RenderStats *tally) {
+  __atomic_fetch_add(&stats->escaped, tally->escaped, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->interior, tally->interior, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->iterations, tally->iterations, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->score, tally->score, __ATOMIC_RELAXED);
+  for (int k = 0; k < STATS_BINS; k++) {
+    if (tally->histogram[k]) {
+      __atomic_fetch_add(&stats->histogram[k], tally->histogram[k],
+                         __ATOMIC_RELAXED);
+    }
+  }
+  __atomic_fetch_add(&stats->formulaNanoseconds, tally->formulaNanoseconds,
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->colorNanoseconds, tally->colorNanoseconds,
+                     __ATOMIC_RELAXED);
+}
+
+// Draw stats->cost as a heatmap (black for pixels that cost nothing, then
+// purple, red, yellow and white for the most expensive), on a log scale so the
+// cheap pixels don't all look the same
+extern void statsHeatmap(const RenderStats *stats, int w, int h,
+                         uint32_t *colors) {
+  static const uint32_t ramp[5] = {0xff000000, 0xff801050, 0xff1040e0,
+                                   0xff40e0ff, 0xffffffff};
+  uint32_t most = 0;
+  for (int i = 0; i < w * h; i++) {
+    most = stats->cost[i] > most ? stats->cost[i] : most;
+  }
+  float scale = most ? 4.0f / flog2(1.0f + most) : 0.0f;
+  for (int i = 0; i < w * h; i++) {
+    float position = flog2(1.0f + stats->cost[i]) * scale;
+    position = position > 0.0f ? position : 0.0f;
+    int stop = position >= 4.0f ? 3 : (int)position;
+    colors[i] = mix(ramp[stop], ramp[stop + 1],
+                    (uint32_t)((position - stop) * 255.0f));
+  }
+}
+
+// Everything run() needs to know about a frame, so the different ways of
+// rendering one (tiles, threads and so on) can share the per-pixel code.
+typedef struct {
+  int type;
+  int w;
+  int h;
+  double posX;
+  double posY;
+  double zoom;
+  float *iters;
+  uint32_t *colors;
+  int iterations;
+  uint32_t *pallete;
+  int palleteLength;
+  uint32_t interiorColor;
+  int renderMode;
+  int darkenEffect;
+  float speed;
+  float flowAmount;
+  // What's left of posX and posY past a double's precision (see
+  // setPositionLow())
+  double posXLow;
+  double posYLow;
+  // The precision forced by setPrecision() (see forcedPrecision)
+  int forcedPrecision;
+  // The Julia set drawn, if it's on (see setJulia())
+  JuliaSet julia;
+  // Where the render statistics go (NULL for none)
+  RenderStats *stats;
+  // Charge the budget in nanoseconds from the cost model instead of the score
+  // (see runTimed())
+  int timed;
+  // The compact field (see runCompact()) in place of iters, when counts isn't
+  // NULL, and how many bits of each count are fraction
+  uint16_t *counts;
+  uint8_t *shades;
+  int countFraction;
+  // How far apart rows of colors and of iters (or the compact field) are, and
+  // how far the shading is from the counts in iters (see runRect(), and
+  // runTiles() goes by them too). 0 is w, w and w * h, a frame of its own.
+  int colorStride;
+  int itersStride;
+  int planeSize;
+  // The render generation this render belongs to, or 0 for one that can't be
+  // cancelled (see cancelRenders())
+  int generation;
+  // The lookup table for pallete, or NULL to work the colors out the long way
+  // (preparePalette() fills this in)
+  const struct PaletteTable *table;
+} RenderParams;
+
+// Add what a render counted to p->stats. Whatever time didn't go to the formula
+// went to coloring.
+static void finishTally(const RenderParams *p, RenderStats *tally, int score,
+                        long long started) {
+  tally->score = score;
+  tally->colorNanoseconds =
+      statsClock() - started - tally->formulaNanoseconds;
+  mergeStats(p->stats, tally);
+}
+
+// Palette lookup tables. getPallete() is a fair bit of work per pixel
+// (renderMode 1 especially), but before the darkening its color only depends
+// on which segment the position is in and how far along it is (mod), so that
+// is worked out ahead of time. Each segment is cut into PALETTE_STEPS steps,
+// and as the color only changes at a few hundred points along a segment, most
+// steps have just one color and the rest change color once, at a known mod. A
+// lookup costs the same whatever the render mode. Building a step only probes
+// PALETTE_CHECKS points either side of its split, so a step that changes color
+// again between probes can keep the one split; the colors can then be 1 off
+// (in any channel) from what getPallete() gives, and never more. A step where
+// the probes do see a second change is marked by a 0 alpha (real colors are
+// always opaque) and goes through segmentColor() after all. There is a table
+// per palette and render mode; palettes longer than PALETTE_SEGMENTS don't use
+// one.
+
+#define PALETTE_STEPS 2048
+#define PALETTE_SEGMENTS 16
+// How many points either side of a split are checked when building the table
+#define PALETTE_CHECKS 64
+
+typedef struct {
+  uint32_t below;
+  uint32_t above;
+  // below applies for mods under this, above from it on
+  float split;
+} PaletteStep;
+
+typedef struct PaletteTable {
+  PaletteStep steps[PALETTE_SEGMENTS * PALETTE_STEPS];
+  // What the table was built from (the palette repeats its first color at the
+  // end, hence the + 1)
+  uint32_t colors[PALETTE_SEGMENTS + 1];
+  int length;
+  int renderMode;
+} PaletteTable;
+
+// Renders hold on to their table until they finish, so a table is never
+// changed once it's handed out. Natively renders can overlap (fractal_server,
+// runTiles() with different palettes), so there are a few tables, built under
+// a lock, and a palette that doesn't fit goes without. The WASM build only
+// renders one thing at a time, so its one table just gets rebuilt.
+#ifdef __wasm__
+#define PALETTE_TABLES 1
+#else
+#define PALETTE_TABLES 4
+static pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static PaletteTable paletteTables[PALETTE_TABLES];
+static int tablesBuilt;
+
+// Floats in [0, 1) sort the same as their bits, which makes searching them easy
+static inline float floatFromBits(uint32_t bits) {
+  union {
+    uint32_t integer;
+    float number;
+  } value = {bits};
+  return value.number;
+}
+
+static inline uint32_t bitsFromFloat(float number) {
+  union {
+    float number;
+    uint32_t integer;
+  } value = {number};
+  return value.integer;
+}
+
+static PaletteStep buildStep(const uint32_t *pallete, int id, int step,
+                             int renderMode) {
+  uint32_t first = bitsFromFloat((float)step / PALETTE_STEPS);
+  uint32_t last = bitsFromFloat((float)(step + 1) / PALETTE_STEPS) - 1;
+  PaletteStep entry;
+  entry.below = segmentColor(pallete, id, floatFromBits(first), renderMode);
+  entry.above = segmentColor(pallete, id, floatFromBits(last), renderMode);
+  entry.split = floatFromBits(last + 1);
+  uint32_t low = last;
+  uint32_t high = last + 1;
+  if (entry.below != entry.above) {
+    // Find the first mod with the second color
+    low = first;
+    high = last;
+    while (high - low > 1) {
+      uint32_t middle = low + (high - low) / 2;
+      if (segmentColor(pallete, id, floatFromBits(middle), renderMode) ==
+          entry.below) {
+        low = middle;
+      } else {
+        high = middle;
+      }
+    }
+    entry.split = floatFromBits(high);
+  }
+  // Check for anything else going on either side of the split (the color can
+  // change and then change back, too). This only looks at the probes, and a
+  // change between two of them goes unnoticed.
+  for (int k = 1; k < PALETTE_CHECKS; k++) {
+    uint32_t before = low - (uint64_t)(low - first) * k / PALETTE_CHECKS;
+    uint32_t after = high + (uint64_t)(last - high) * k / PALETTE_CHECKS;
+    if (segmentColor(pallete, id, floatFromBits(before), renderMode) !=
+            entry.below ||
+        (high <= last &&
+         segmentColor(pallete, id, floatFromBits(after), renderMode) !=
+             entry.above)) {
+      entry.below = 0;
+      break;
+    }
+  }
+  return entry;
+}
+
+static int tableMatches(const PaletteTable *table, const RenderParams *p) {
+  if (table->length != p->palleteLength ||
+      table->renderMode != p->renderMode) {
+    return 0;
+  }
+  for (int k = 0; k <= table->length; k++) {
+    if (table->colors[k] != p->pallete[k]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void buildTable(PaletteTable *table, const RenderParams *p) {
+  for (int k = 0; k <= p->palleteLength; k++) {
+    table->colors[k] = p->pallete[k];
+  }
+  table->length = p->palleteLength;
+  table->renderMode = p->renderMode;
+  for (int id = 0; id < table->length; id++) {
+    for (int step = 0; step < PALETTE_STEPS; step++) {
+      table->steps[id * PALETTE_STEPS + step] =
+          buildStep(p->pallete, id, step, p->renderMode);
+    }
+  }
+}
+
+// Find (or build) the table for p's palette and put it in p->table. Everything
+// that colors pixels calls this first.
+static void preparePalette(RenderParams *p) {
+  p->table = NULL;
+  if (p->palleteLength < 1 || p->palleteLength > PALETTE_SEGMENTS) {
+    return;
+  }
+#ifdef __wasm__
+  if (!tablesBuilt || !tableMatches(paletteTables, p)) {
+    buildTable(paletteTables, p);
+    tablesBuilt = 1;
+  }
+  p->table = paletteTables;
+#else
+  pthread_mutex_lock(&tableLock);
+  for (int k = 0; k < tablesBuilt && !p->table; k++) {
+    if (tableMatches(paletteTables + k, p)) {
+      p->table = paletteTables + k;
+    }
+  }
+  if (!p->table && tablesBuilt < PALETTE_TABLES) {
+    buildTable(paletteTables + tablesBuilt, p);
+    p->table = paletteTables + tablesBuilt++;
+  }
+  pthread_mutex_unlock(&tableLock);
+#endif
+}
+
+// segmentColor() from the table
+static inline uint32_t lookupSegment(const PaletteTable *table, int id,
+                                     float mod) {
+  int step = mod * PALETTE_STEPS;
+  step = step < 0 ? 0 : step < PALETTE_STEPS ? step : PALETTE_STEPS - 1;
+  const PaletteStep *entry = table->steps + id * PALETTE_STEPS + step;
+  if (!entry->below) {
+    return segmentColor(table->colors, id, mod, table->renderMode);
+  }
+  return mod < entry->split ? entry->below : entry->above;
+}
+
+// getPallete() from the table
+static inline uint32_t lookupPallete(const PaletteTable *table,
+                                     float position, float darkenAmount) {
+  int length = table->length;
+  int id = (int)position % length;
+  float mod = position - ((int)position / length) * length - (float)id;
+  return mixBlack(lookupSegment(table, id, mod), 200 * darkenAmount);
+}
+
+// Color a pixel that already has its smoothed iteration count t and shading l
+static inline uint32_t colorPixel(const RenderParams *p, float t, float l,
+                                  float speed1, float speed2) {
+  if (t == -999.0f) {
+    return p->interiorColor;
+  }
+  float darkenAmount = p->darkenEffect == 2 ? 1.0f - l : l;
+  if (t == 1.0f) {
+    int index = p->flowAmount;
+    int indexModulo = index % p->palleteLength;
+    return mix2(p->pallete[indexModulo], p->pallete[indexModulo + 1],
+                p->flowAmount - index, p->renderMode, darkenAmount);
+  }
+  float position = flog2(t) * speed1 + (t - 1) * speed2 + p->flowAmount;
+  if (p->table) {
+    return lookupPallete(p->table, position, darkenAmount);
+  }
+  return getPallete(position, p->pallete, p->palleteLength, p->renderMode,
+                    darkenAmount);
+}
+
+// Charge a freshly iterated pixel to the score, and tidy up its count
+static inline float settlePixel(float n, int biggerIterations, int *score) {
+  // Cost increases are pre-computed to be as stable as possible (at least for
+  // my computer)
+  if (n == -999.0f) {
+    *score += biggerIterations;
+  }
+  // What's this number? If flog2() has a value less than this, it gives a
+  // negative number, which will cause problems.
+  else if (n < 1.000004f) {
+    n = 1.0f;
+  } else {
+    *score += 13 + (int)n;
+  }
+  return n;
+}
+
+// The budget to use in place of max when the score is checked after charging
+// anything up to worst, so it can't overflow (whatever max was, even INT_MAX)
+static inline int capBudget(int max, long long worst) {
+  long long most = INT_MAX - worst;
+  most = most > 0 ? most : 0;
+  return max < most ? max : (int)most;
+}
+
+// Compact fields. iters takes 8 bytes a pixel, which at 4K and up is a lot of
+// memory (and of cache, when recoloring). runCompact() and recolorCompact()
+// keep the same things in 3 bytes instead: the smoothed count as a 16-bit
+// fixed-point number in counts, and the shading as a byte in shades. Counts
+// get as many bits of fraction as fit above iterations (6 for 1000
+// iterations), with 0 still meaning not computed yet and COMPACT_INTERIOR
+// standing for -999. The shading is kept in 200ths, which is all of it that
+// colorPixel() uses (the darkening is 200 * l, rounded down).
+#define COMPACT_INTERIOR 0xffff
+
+// How many bits of fraction the counts get
+static inline int compactFraction(int iterations) {
+  int bits = 0;
+  while (bits < 15 && iterations + 1 <= (COMPACT_INTERIOR - 1) >> (bits + 1)) {
+    bits++;
+  }
+  return bits;
+}
+
+// A settled count (see settlePixel()) in compact form
+static inline uint16_t compactCount(float t, int fraction) {
+  if (t == -999.0f) {
+    return COMPACT_INTERIOR;
+  }
+  float scaled = t * (1 << fraction) + 0.5f;
+  int count = scaled < COMPACT_INTERIOR - 1 ? (int)scaled
+                                            : COMPACT_INTERIOR - 1;
+  // (Rounding down to exactly 1 would make it the flow color)
+  return count == 1 << fraction && t != 1.0f ? count + 1 : count;
+}
+
+static inline float countOf(uint16_t count, int fraction) {
+  return count == COMPACT_INTERIOR ? -999.0f
+                                   : count * (1.0f / (1 << fraction));
+}
+
+static inline uint8_t compactShade(float l) {
+  float scaled = l * 200.0f;
+  return scaled < 255.0f ? (uint8_t)scaled : 255;
+}
+
+// (Halfway through the 200th, so 200 * l rounds down to the same number)
+static inline float shadeOf(uint8_t shade) {
+  return (shade + 0.5f) * (1.0f / 200.0f);
+}
+
+// Render generations. When the view moves, a render that's still going (on
+// another thread, or in a web worker sharing the WASM memory) is only wasting
+// time. cancelRenders() starts a new generation, and every render from before
+// it stops at its next batch of pixels, as though it had run out of budget: it
+// returns where it got to, and everything it finished stays in iters for pan()
+// or reproject() to carry over to the new view (or for the next call to pick
+// up from, if the view didn't change after all). A script can also bump the
+// generation itself, with Atomics.add() on the int at
+// renderGenerationAddress().
+
+static int renderGeneration = 1;
+
+static inline int currentGeneration(void) {
+  return __atomic_load_n(&renderGeneration, __ATOMIC_RELAXED);
+}
+
+extern void cancelRenders(void) {
+  __atomic_add_fetch(&renderGeneration, 1, __ATOMIC_RELAXED);
+}
+
+extern int *renderGenerationAddress(void) { return &renderGeneration; }
+
+static inline int cancelled(const RenderParams *p) {
+  return p->generation && p->generation != currentGeneration();
+}
+
+// -----
+
+// Julia sets (see JuliaSet). setJulia() turns them on for the next frames,
+// with c = (x, y), or off again (each render takes whatever was set when it
+// started). Every renderer draws them, though runDeep()
+// only goes as deep as run() does for them.
+//
+// Julia sets are mostly symmetric: the even formulas send z and -z to the same
+// place, so their Julia sets have point symmetry for any c, the ones with a
+// real c are their own mirror image across the real axis (conjugate symmetry),
+// and so on (see symmetryOf()). When the frame's pixel grid lines up with the
+// axes, which it does for a view centered on 0, half of it (or three quarters)
+// is copied from the pixels it mirrors rather than iterated. The directional
+// shadings don't always come along unchanged: the mirror image of a shade l is
+// 1.2 - l for some formulas, and for some there's no telling, so those aren't
+// mirrored with that shading. Only the rectangle being rendered is mirrored
+// from, since the rest of a shared frame could be halfway through being
+// written by another thread.
+
+extern void setJulia(int on, double x, double y) {
+  juliaDefault.on = on;
+  juliaDefault.x = on ? x : 0;
+  juliaDefault.y = on ? y : 0;
+}
+
+#define MIRROR_NONE 0
+#define MIRROR_SAME 1
+// The shading turns into 1.2 - l
+#define MIRROR_FLIPPED 2
+
+// Mirroring twice, one after the other
+static inline int mirrorBoth(int a, int b) {
+  if (!a || !b) {
+    return MIRROR_NONE;
+  }
+  return a == b ? MIRROR_SAME : MIRROR_FLIPPED;
+}
+
+// How p's Julia set looks flipped across the imaginary axis (flipX), the real
+// axis (flipY) or both (point symmetry), in shading mode shading: MIRROR_NONE
+// if it isn't symmetric that way.
+static int symmetryOf(const RenderParams *p, int shading, int flipX,
+                      int flipY) {
+  int type = p->type;
+  int derivative = shading == 1 && HAS_DERIVATIVE(type);
+  // The formulas that take the absolute value of both parts before they do
+  // anything else don't care about either sign. The derivative does, though.
+  int folded = (type >= 6 && type <= 8) || type == 11;
+  int odd = type == 1 || type == 3 || type == 5 || type == 14;
+  // z -> -z: the rest of the formulas are even (prmb isn't, as it starts from
+  // (|x|, -y)). Only the first step of the derivative changes, by a factor of
+  // -1 when its power of z is odd.
+  int point = MIRROR_NONE;
+  if (!odd && type != 10) {
+    point = derivative && type != 7 ? MIRROR_FLIPPED : MIRROR_SAME;
+  }
+  // z -> conj(z), for a real c (or any c if folded). The funky shading turns
+  // over (apart from the mbbs ones, which switch formulas halfway), and the
+  // derivative gets conjugated, which can't be undone from l.
+  int conjugate = MIRROR_NONE;
+  if ((folded || p->julia.y == 0) && !derivative) {
+    if (folded || shading != 2) {
+      conjugate = MIRROR_SAME;
+    } else if (type < 13) {
+      conjugate = MIRROR_FLIPPED;
+    }
+  }
+  // z -> -conj(z): the folded ones again, prmb for any c since it only looks
+  // at |x|, and the odd ones when c is imaginary
+  int across = MIRROR_NONE;
+  if (folded || type == 10 || (odd && p->julia.x == 0)) {
+    across = derivative ? MIRROR_NONE : MIRROR_SAME;
+  }
+  // Any two of them make the third
+  if (flipX && flipY) {
+    return point ? point : mirrorBoth(across, conjugate);
+  }
+  if (flipX) {
+    return across ? across : mirrorBoth(point, conjugate);
+  }
+  return conjugate ? conjugate : mirrorBoth(point, across);
+}
+
+// Where a frame's mirror images are
+typedef struct {
+  // Pixel (x, y) mirrors (centerX - x, y) across the imaginary axis and
+  // (x, centerY - y) across the real one (-1 when that axis isn't on the grid)
+  int centerX;
+  int centerY;
+  // symmetryOf() for flipping x, y and both
+  int flipX;
+  int flipY;
+  int flipBoth;
+} Mirror;
+
+// Where an axis is on the grid, as twice its pixel: origin + center * spacing
+// has to be -origin, to within a 4096th of a pixel (which is what floats are
+// allowed, too)
+static int mirrorCenter(double origin, double spacing, int size) {
+  double center = -2.0 * origin / spacing;
+  if (!(center > -0.5 && center < 2.0 * size)) {
+    return -1;
+  }
+  int nearest = (int)(center + 0.5);
+  return fabs(center - nearest) < 1.0 / 4096 ? nearest : -1;
+}
+
+static Mirror mirrorOf(const RenderParams *p, int shading) {
+  Mirror mirror = {-1, -1, MIRROR_NONE, MIRROR_NONE, MIRROR_NONE};
+  if (!p->julia.on) {
+    return mirror;
+  }
+  mirror.centerX = mirrorCenter(p->posX + p->posXLow, p->zoom, p->w);
+  mirror.centerY = mirrorCenter(p->posY + p->posYLow, p->zoom, p->h);
+  if (mirror.centerX >= 0) {
+    mirror.flipX = symmetryOf(p, shading, 1, 0);
+  }
+  if (mirror.centerY >= 0) {
+    mirror.flipY = symmetryOf(p, shading, 0, 1);
+  }
+  if (mirror.centerX >= 0 && mirror.centerY >= 0) {
+    mirror.flipBoth = symmetryOf(p, shading, 1, 1);
+  }
+  return mirror;
+}
+
+// The index in iters (or the compact field) of the mirror image of pixel
+// (x, y) if it's in [x0, x1) x [y0, y1) and has been computed already, or -1.
+// *how gets its MIRROR_* symmetry.
+static inline int mirrorSource(const RenderParams *p, const Mirror *mirror,
+                               int x, int y, int x0, int y0, int x1, int y1,
+                               int itersStride, int *how) {
+  // Across the real axis first, as whole rows above are done
+  int symmetries[3] = {mirror->flipY, mirror->flipX, mirror->flipBoth};
+  for (int k = 0; k < 3; k++) {
+    int mx = k == 0 ? x : mirror->centerX - x;
+    int my = k == 1 ? y : mirror->centerY - y;
+    if (!symmetries[k] || mx < x0 || mx >= x1 || my < y0 || my >= y1) {
+      continue;
+    }
+    int index = my * itersStride + mx;
+    if (p->counts ? p->counts[index] : p->iters[index]) {
+      *how = symmetries[k];
+      return index;
+    }
+  }
+  return -1;
+}
+
+// -----
+
+// Precision. Doubles are only needed once the view is small enough that
+// floats can't tell neighboring pixels apart, and the float kernels go about
+// twice as fast (more in WASM), so a rectangle of the frame is iterated in
+// floats whenever
+//
+//   zoom >= FLOAT_MIN_SPACING * the largest coordinate in it (at least 2)
+//
+// Floats have 24 bits of mantissa, so that keeps neighboring pixels at least
+// 2^12 float steps apart, and rounding c to a float moves each pixel by under
+// 1/4096 of a pixel. The rounding while iterating adds about as much again
+// (it's the early steps that count, and the orbit stays under 2 until it
+// escapes, hence the floor). So a float pixel is the double one sampled a hair
+// off center, which only changes anything for pixels right on the boundary.
+// Past that it's doubles, and past the same point for doubles (29 more bits
+// down) it's double-doubles, one rectangle (or tile) at a time. Derivative
+// shading is never in floats, as the derivative overflows a float on long
+// orbits.
+
+#define PRECISION_FLOAT 0
+#define PRECISION_DOUBLE 1
+#define PRECISION_DOUBLE_DOUBLE 2
+#define PRECISIONS 3
+
+#define FLOAT_MIN_SPACING (1.0 / (1 << 12))
+#define DOUBLE_MIN_SPACING (FLOAT_MIN_SPACING / (1 << 29))
+
+// The precision the next frames are forced to (apart from derivative shading),
+// plus 1, or 0 to pick it as above. Renders keep it in their RenderParams, so
+// the 0 of one that doesn't set it means the same.
+static int forcedPrecision;
+
+// One of the PRECISION_* values forces it, anything else (-1) picks it again
+extern void setPrecision(int precision) {
+  int valid = precision >= 0 && precision < PRECISIONS;
+  forcedPrecision = valid ? precision + 1 : 0;
+}
+
+// The precision for points spacing apart, none of them further than largest
+// from 0 on either axis (forced works like forcedPrecision)
+static int precisionFor(double spacing, double largest, int forced, int type,
+                        int darkenEffect) {
+  int precision = forced - 1;
+  if (precision < 0) {
+    largest = largest > 2.0 ? largest : 2.0;
+    if (spacing >= FLOAT_MIN_SPACING * largest) {
+      precision = PRECISION_FLOAT;
+    } else if (spacing >= DOUBLE_MIN_SPACING * largest) {
+      precision = PRECISION_DOUBLE;
+    } else {
+      precision = PRECISION_DOUBLE_DOUBLE;
+    }
+  }
+  if (precision == PRECISION_FLOAT && shadingOf(darkenEffect) == 1 &&
+      HAS_DERIVATIVE(type)) {
+    return PRECISION_DOUBLE;
+  }
+  return precision;
+}
+
+static int precisionOf(const RenderParams *p, int x0, int y0, int x1,
+                       int y1) {
+  double largest = 0;
+  double corners[4] = {p->posX + x0 * p->zoom, p->posX + x1 * p->zoom,
+                       p->posY + y0 * p->zoom, p->posY + y1 * p->zoom};
+  for (int k = 0; k < 4; k++) {
+    largest = fabs(corners[k]) > largest ? fabs(corners[k]) : largest;
+  }
+  return precisionFor(p->zoom, largest, p->forcedPrecision, p->type,
+                      p->darkenEffect);
+}
+
+// The kernels a rectangle gets. Only doubles have a single pixel kernel; the
+// others always go through lanes, even for a lone pixel.
+typedef struct {
+  int precision;
+  LaneKernel lanes;
+  PixelKernel single;
+  int width;
+} Kernels;
+
+static inline Kernels kernelsFor(int precision, int type, int shading) {
+  if (!laneKernels) {
+    laneKernels = pickLaneKernels();
+  }
+  Kernels kernels = {precision, laneKernels[precision][shading][type], NULL,
+                     LANES};
+  if (precision == PRECISION_FLOAT) {
+    kernels.width = FLOAT_LANES;
+  } else if (precision == PRECISION_DOUBLE) {
+    kernels.single = pixelKernels[shading][type];
+  }
+  return kernels;
+}
+
+static inline Kernels pickKernels(const RenderParams *p, int x0, int y0,
+                                  int x1, int y1) {
+  return kernelsFor(precisionOf(p, x0, y0, x1, y1), p->type,
+                    shadingOf(p->darkenEffect));
+}
+
+// What pixels really cost, for runTimed(). The score above is a guess that's
+// only right on one computer, and it charges interior pixels the whole
+// iteration limit even when the cycle check stops them early. The cost model
+// charges a pixel pixelNs plus iterationNs for each iteration it really did,
+// with a pair for every formula and shading mode, and colorNs for a pixel that
+// only needs coloring. There's one for each precision, too.
+typedef struct {
+  float pixelNs;
+  float iterationNs;
+  // Whether a real measurement has corrected this pair yet
+  int refined;
+} CostModel;
+
+static CostModel costModels[PRECISIONS][3][16];
+static float colorNs;
+
+// Charge a freshly iterated pixel that did steps iterations
+static inline int pixelCost(const CostModel *model, int steps) {
+  return (int)(model->pixelNs + steps * model->iterationNs + 0.5f);
+}
+
+// Render the pixels of the rectangle [x0, x1) x [y0, y1) in raster order,
+// starting at the index pixel inside the rectangle. Returns the index to resume
+// from once *score goes over max, or -1 when the rectangle is done (max is
+// capped so *score can't overflow, so even INT_MAX can run out). counting
+// says whether to keep statistics, timed whether to charge *score from the
+// cost model (see renderRect()) and compact whether the frame is kept in the
+// compact field rather than iters.
+static inline __attribute__((always_inline)) int renderRectLoop(
+    const RenderParams *p, int x0, int y0, int x1, int y1, int pixel, int max,
+    int *score, const int counting, const int timed, const int compact) {
+  int W = x1 - x0;
+  int limit = W * (y1 - y0);
+  int i = pixel;
+  int x = x0 + i % W;
+  int y = y0 + i / W;
+  int colorStride = p->colorStride ? p->colorStride : p->w;
+  int itersStride = p->itersStride ? p->itersStride : p->w;
+  int planeSize = p->planeSize ? p->planeSize : p->w * p->h;
+  int biggerIterations = p->iterations + 2;
+  float *iters = p->iters;
+  uint32_t *colors = p->colors;
+
+  // Pre-calculate speed constants for faster renderings
+  float speed1 = sqrtf(sqrtf(p->speed));
+  float speed2 = 0.035f * p->speed;
+  float batch[FLOAT_LANES];
+  // (The compact field has nowhere for the kernels to put the shading, so it
+  // goes here first)
+  float shades[FLOAT_LANES];
+  int fraction = p->countFraction;
+  int batchStart = 0;
+  int batchEnd = 0;
+  // The formula, shading and precision are settled for the whole call
+  int shading = shadingOf(p->darkenEffect);
+  Kernels kernels = pickKernels(p, x0, y0, x1, y1);
+  LaneKernel lanes = kernels.lanes;
+  PixelKernel single = kernels.single;
+  int deep = kernels.precision == PRECISION_DOUBLE_DOUBLE;
+  // A Julia set's pixels that can be copied from their mirror image
+  Mirror mirror = mirrorOf(p, shading);
+  int mirroring = mirror.flipX || mirror.flipY || mirror.flipBoth;
+  int how = MIRROR_NONE;
+  // Statistics are kept here and added to p->stats at the end
+  RenderStats counts;
+  RenderStats *tally = NULL;
+  int steps[FLOAT_LANES] = {0};
+  int *wantSteps = counting || timed ? steps : NULL;
+  const CostModel *model = &costModels[kernels.precision][shading][p->type];
+  int colorCost = (int)(colorNs + 0.5f);
+  // (*score is checked after every pixel)
+  max = capBudget(max, timed ? pixelCost(model, p->iterations) + colorCost
+                             : p->iterations + 13);
+  int scoreBefore = *score;
+  long long started = 0;
+  if (counting) {
+    counts = (RenderStats){0};
+    tally = &counts;
+    started = statsClock();
+  }
+  int result = -1;
+
+  // This uses a do...while rather than a simple while, so it doesn't increment
+  // the first time.
+  do {
+    if (x == x1) {
+      x = x0;
+      y++;
+    }
+    int index = y * itersStride + x;
+    uint32_t *color = colors + y * colorStride + x;
+    float t = compact ? countOf(p->counts[index], fraction) : iters[index];
+    float *ptr = compact ? shades : iters + planeSize + index;
+    int source = !t && mirroring ? mirrorSource(p, &mirror, x, y, x0, y0, x1,
+                                                y1, itersStride, &how)
+                                 : -1;
+    if (source >= 0) {
+      // Copied, after which it only needs coloring like any other
+      if (compact) {
+        uint16_t count = p->counts[source];
+        uint8_t shade = p->shades[source];
+        if (how == MIRROR_FLIPPED && count != COMPACT_INTERIOR) {
+          shade = compactShade(1.2f - shadeOf(shade));
+        }
+        p->counts[index] = count;
+        p->shades[index] = shade;
+        t = countOf(count, fraction);
+      } else {
+        float l = iters[planeSize + source];
+        t = iters[source];
+        iters[index] = t;
+        *ptr = how == MIRROR_FLIPPED && t != -999.0f ? 1.2f - l : l;
+      }
+    }
+    if (t) {
+      float l = compact ? shadeOf(p->shades[index]) : *ptr;
+      *color = colorPixel(p, t, l, speed1, speed2);
+      x++;
+      // (Resuming after this pixel, as it needs nothing more, so even a tiny
+      // budget gets somewhere)
+      if (timed && (*score += colorCost) > max) {
+        result = i + 1 < limit ? i + 1 : -1;
+        break;
+      }
+      continue;
+    }
+    double coordinateY = p->posY + y * p->zoom;
+
+    float n;
+    if (i >= batchEnd) {
+      if (cancelled(p)) {
+        result = i;
+        break;
+      }
+      // Gather the uncomputed pixels that follow in this row so they can be
+      // iterated together
+      int count = 1;
+      int rowLeft = x1 - x;
+      while (count < kernels.width && count < rowLeft &&
+             !(compact ? p->counts[index + count] : iters[index + count]) &&
+             !(mirroring && mirrorSource(p, &mirror, x + count, y, x0, y0, x1,
+                                         y1, itersStride, &how) >= 0)) {
+        count++;
+      }
+      if (count > 1 || !single) {
+        double xs[FLOAT_LANES];
+        double xsLow[FLOAT_LANES];
+        double ys[FLOAT_LANES];
+        double ysLow[FLOAT_LANES];
+        double yLow =
+            deep ? lowPart(p->posY, y * p->zoom, coordinateY, p->posYLow) : 0;
+        for (int k = 0; k < count; k++) {
+          double offset = (x + k) * p->zoom;
+          xs[k] = p->posX + offset;
+          xsLow[k] = deep ? lowPart(p->posX, offset, xs[k], p->posXLow) : 0;
+          ys[k] = coordinateY;
+          ysLow[k] = yLow;
+          shades[k] = 0;
+        }
+        long long clock = tally ? statsClock() : 0;
+        lanes(p->iterations, &p->julia, xs, xsLow, ys, ysLow, count, batch,
+              ptr, wantSteps);
+        if (tally) {
+          tally->formulaNanoseconds += statsClock() - clock;
+        }
+        batchStart = i;
+        batchEnd = i + count;
+      }
+    }
+    int step = 0;
+    if (i < batchEnd) {
+      n = batch[i - batchStart];
+      step = steps[i - batchStart];
+    } else {
+      long long clock = tally ? statsClock() : 0;
+      shades[0] = 0;
+      n = single(p->iterations, &p->julia, p->posX + x * p->zoom,
+                 coordinateY, ptr, wantSteps ? &step : NULL);
+      if (tally) {
+        tally->formulaNanoseconds += statsClock() - clock;
+      }
+    }
+    if (tally) {
+      // (Only counted once it's used: a batch can be cut short by the budget)
+      tallyPixel(tally, p->stats->cost, index, n, step, p->iterations);
+    }
+    x++;
+    if (timed) {
+      int unused = 0;
+      n = settlePixel(n, biggerIterations, &unused);
+      *score += pixelCost(model, step);
+    } else {
+      n = settlePixel(n, biggerIterations, score);
+    }
+    float l = *ptr;
+    if (compact) {
+      // (Colored from what's stored, so recolorCompact() gets the same)
+      uint16_t count = compactCount(n, fraction);
+      uint8_t shade =
+          compactShade(shades[i < batchEnd ? i - batchStart : 0]);
+      p->counts[index] = count;
+      p->shades[index] = shade;
+      n = countOf(count, fraction);
+      l = shadeOf(shade);
+    } else {
+      iters[index] = n;
+    }
+    *color = colorPixel(p, n, l, speed1, speed2);
+    if (*score > max) {
+      result = i;
+      break;
+    }
+  } while (++i != limit);
+  if (tally) {
+    finishTally(p, tally, *score - scoreBefore, started);
+  }
+  return result;
+}
+
+// Keeping statistics, the cost model and the compact field get their own
+// copies of the loop, so they cost nothing when they're off
+static int renderRect(const RenderParams *p, int x0, int y0, int x1, int y1,
+                      int pixel, int max, int *score) {
+  if (p->counts) {
+    if (p->stats) {
+      return renderRectLoop(p, x0, y0, x1, y1, pixel, max, score, 1, 0, 1);
+    }
+    return renderRectLoop(p, x0, y0, x1, y1, pixel, max, score, 0, 0, 1);
+  }
+  if (p->timed) {
+    if (p->stats) {
+      return renderRectLoop(p, x0, y0, x1, y1, pixel, max, score, 1, 1, 0);
+    }
+    return renderRectLoop(p, x0, y0, x1, y1, pixel, max, score, 0, 1, 0);
+  }
+  if (p->stats) {
+    return renderRectLoop(p, x0, y0, x1, y1, pixel, max, score, 1, 0, 0);
+  }
+  return renderRectLoop(p, x0, y0, x1, y1, pixel, max, score, 0, 0, 0);
+}
+
+extern int run(int type, int w, int h, int pixel, double posX, double posY,
+               double zoom, int max, float *iters, uint32_t *colors,
+               int iterations, uint32_t *pallete, int palleteLength,
+               uint32_t interiorColor, int renderMode, int darkenEffect,
+               float speed, float flowAmount) {
+  // The boring stuff is here! We use 32-bit RGBA uint32_t instead of 8-bit
+  // numbers for the coloring, because it's simpler and doesn't slow down JS at
+  // all (we can access it with Uint8ClampedArray)
+  RenderParams p = {.type = type,
+                    .w = w,
+                    .h = h,
+                    .posX = posX,
+                    .posY = posY,
+                    .zoom = zoom,
+                    .iters = iters,
+                    .colors = colors,
+                    .iterations = iterations,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .posXLow = positionLowX,
+                    .posYLow = positionLowY,
+                    .forcedPrecision = forcedPrecision,
+                    .julia = juliaDefault,
+                    .stats = renderStats,
+                    .generation = currentGeneration()};
+  int score = 0;
+  preparePalette(&p);
+  // Tell the script whether it has completed (-1) or where to pick back up
+  return renderRect(&p, 0, 0, w, h, pixel, max, &score);
+}
+
+// Same as run(), but for just the rectangle [x0, x1) x [y0, y1) of a bigger
+// canvas, straight into its buffers: pixel (x, y) is still at posX + x * zoom,
+// but its color goes in colors[y * colorStride + x], its count in
+// iters[y * itersStride + x] and its shading planeSize floats after that (and
+// render statistics count it at the same index as iters). So a tile can be
+// rendered right where it goes in a shared framebuffer or ImageData, and a
+// frame can be done in blocks small enough to stay in the cache. pixel and the
+// index this returns count the pixels of the rectangle in raster order.
+extern int runRect(int type, int x0, int y0, int x1, int y1, int pixel,
+                   double posX, double posY, double zoom, int max,
+                   float *iters, int itersStride, int planeSize,
+                   uint32_t *colors, int colorStride, int iterations,
+                   uint32_t *pallete, int palleteLength,
+                   uint32_t interiorColor, int renderMode, int darkenEffect,
+                   float speed, float flowAmount) {
+  if (x0 >= x1 || y0 >= y1) {
+    return -1;
+  }
+  RenderParams p = {.type = type,
+                    .w = x1,
+                    .h = y1,
+                    .posX = posX,
+                    .posY = posY,
+                    .zoom = zoom,
+                    .iters = iters,
+                    .colors = colors,
+                    .iterations = iterations,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .posXLow = positionLowX,
+                    .posYLow = positionLowY,
+                    .forcedPrecision = forcedPrecision,
+                    .julia = juliaDefault,
+                    .stats = renderStats,
+                    .generation = currentGeneration(),
+                    .colorStride = colorStride,
+                    .itersStride = itersStride,
+                    .planeSize = planeSize};
+  int score = 0;
+  preparePalette(&p);
+  return renderRect(&p, x0, y0, x1, y1, pixel, max, &score);
+}
+
+// Same as run(), but keeping the frame in the compact field (see
+// compactFraction()): counts and shades are w * h each, and 0 in counts for
+// pixels still to do. recolorCompact() recolors it.
+extern int runCompact(int type, int w, int h, int pixel, double posX,
+                      double posY, double zoom, int max, uint16_t *counts,
+                      uint8_t *shades, uint32_t *colors, int iterations,
+                      uint32_t *pallete, int palleteLength,
+                      uint32_t interiorColor, int renderMode, int darkenEffect,
+                      float speed, float flowAmount) {
+  RenderParams p = {.type = type,
+                    .w = w,
+                    .h = h,
+                    .posX = posX,
+                    .posY = posY,
+                    .zoom = zoom,
+                    .colors = colors,
+                    .iterations = iterations,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .posXLow = positionLowX,
+                    .posYLow = positionLowY,
+                    .forcedPrecision = forcedPrecision,
+                    .julia = juliaDefault,
+                    .stats = renderStats,
+                    .generation = currentGeneration(),
+                    .counts = counts,
+                    .shades = shades,
+                    .countFraction = compactFraction(iterations)};
+  int score = 0;
+  preparePalette(&p);
+  return renderRect(&p, 0, 0, w, h, pixel, max, &score);
+}
+
+// -----
+
+// Time slices. runTimed() is run() with how long it may take (in
+// microseconds) instead of a score to spend, and it charges each pixel what the
+// cost model says it takes. The model starts from numbers measured on a native
+// build, and the pair that was used gets corrected after every call by how
+// long the call really took: native builds time themselves, and WASM can't
+// read a clock, so the script passes how long each call took to
+// reportElapsed(). The first real measurement also scales the pairs that
+// haven't been measured yet, since most of the difference is the computer
+// rather than the formula. Native builds can also measure every pair up front
+// with calibrateTimed(), which takes a few hundred milliseconds, so it's
+// something to do at startup rather than in the middle of a slice.
+
+// How far each measurement moves the model
+#define COST_LEARNING 0.25f
+// Calls shorter than this (in nanoseconds) are too noisy to learn from
+#define COST_MIN_NS 100000
+// How many pixels across the calibration patches are
+#define CALIBRATE_SIZE 32
+
+// Nanoseconds per iteration, by precision, shading mode and formula, and per
+// pixel by precision and shading mode, as measured on a native x86 build. WASM
+// is slower, but the first reportElapsed() fixes that.
+static const float defaultIterationNs[PRECISIONS][3][16] = {
+    {{4.1f, 6.5f, 6.6f, 7.7f, 8.1f, 7.6f, 2.1f, 5.1f, 7.1f, 2.7f, 3.2f, 2.6f,
+      3.6f, 2.6f, 4.9f, 4.8f},
+     {4.7f, 6.5f, 7.1f, 5.9f, 8.3f, 7.3f, 2.6f, 5.4f, 7.9f, 2.7f, 3.1f, 2.6f,
+      3.2f, 2.8f, 5.0f, 4.6f},
+     {4.0f, 6.5f, 6.0f, 7.3f, 8.2f, 7.5f, 2.1f, 5.1f, 7.0f, 2.9f, 3.1f, 2.5f,
+      3.1f, 2.9f, 4.9f, 4.8f}},
+    {{4.2f, 5.8f, 6.2f, 5.2f, 8.6f, 7.3f, 2.2f, 4.8f, 6.6f, 3.1f, 2.8f, 2.9f,
+      3.5f, 2.9f, 5.0f, 5.2f},
+     {4.7f, 6.5f, 7.1f, 5.9f, 8.6f, 7.3f, 2.6f, 5.4f, 7.9f, 3.0f, 2.8f, 2.9f,
+      3.5f, 2.9f, 5.0f, 5.2f},
+     {4.0f, 5.7f, 6.0f, 5.0f, 8.6f, 7.3f, 2.2f, 4.7f, 6.5f, 3.0f, 2.8f, 2.9f,
+      3.5f, 2.8f, 4.9f, 5.1f}},
+    {{29.2f, 39.7f, 38.1f, 39.5f, 73.3f, 66.4f, 13.5f, 33.2f, 40.0f, 16.6f,
+      16.3f, 18.7f, 23.8f, 18.5f, 39.5f, 39.1f},
+     {29.4f, 40.8f, 41.0f, 40.5f, 72.6f, 67.6f, 14.1f, 34.7f, 42.8f, 16.7f,
+      16.4f, 18.9f, 23.6f, 18.4f, 39.4f, 38.5f},
+     {28.3f, 39.5f, 41.3f, 41.5f, 80.4f, 71.4f, 14.1f, 36.0f, 43.7f, 16.7f,
+      16.2f, 18.6f, 23.4f, 18.5f, 39.5f, 38.4f}}};
+static const float defaultPixelNs[PRECISIONS][3] = {{22.0f, 23.0f, 29.0f},
+                                                    {30.0f, 35.0f, 36.0f},
+                                                    {11.0f, 13.0f, 14.0f}};
+#define DEFAULT_COLOR_NS 17.0f
+
+static int costsReady;
+// The last call to runTimed(), for reportElapsed()
+static int lastPrecision;
+static int lastShading = -1;
+static int lastType;
+static long long lastPredicted;
+
+#ifndef __wasm__
+// Render p's whole frame from scratch a few times, and return the fastest time
+// along with how many iterations it took
+static long long timePatch(RenderParams *p, CostModel *model,
+                           long long *steps) {
+  CostModel saved = *model;
+  // (This charges one per iteration, so the score counts them)
+  *model = (CostModel){0.0f, 1.0f, 0};
+  long long best = 0;
+  for (int k = 0; k < 3; k++) {
+    __builtin_memset(p->iters, 0, sizeof(float) * 2 * p->w * p->h);
+    int score = 0;
+    long long started = statsClock();
+    renderRect(p, 0, 0, p->w, p->h, 0, INT_MAX, &score);
+    long long elapsed = statsClock() - started;
+    best = !k || elapsed < best ? elapsed : best;
+    *steps = score;
+  }
+  *model = saved;
+  return best;
+}
+
+// Measure the whole model, rendering with frame's palette and coloring.
+// Far outside the set every pixel escapes straight away, and the whole set has
+// plenty of iterations, so the two together give both costs.
+static void calibrateCosts(const RenderParams *frame) {
+  int pixels = CALIBRATE_SIZE * CALIBRATE_SIZE;
+  float *iters = malloc(sizeof(float) * 2 * pixels);
+  uint32_t *colors = malloc(sizeof(uint32_t) * pixels);
+  if (!iters || !colors) {
+    free(iters);
+    free(colors);
+    return;
+  }
+  RenderParams p = *frame;
+  p.w = CALIBRATE_SIZE;
+  p.h = CALIBRATE_SIZE;
+  p.iters = iters;
+  p.colors = colors;
+  p.iterations = 1000;
+  p.stats = NULL;
+  p.timed = 1;
+  for (int k = 0; k < PRECISIONS * 3 * 16; k++) {
+    int precision = k / 48;
+    int shading = k / 16 % 3;
+    int type = k % 16;
+    if (precision == PRECISION_FLOAT && shading == 1 &&
+        HAS_DERIVATIVE(type)) {
+      // (Never used: derivative shading is never in floats)
+      continue;
+    }
+    p.forcedPrecision = precision + 1;
+    p.darkenEffect = shading == 2 ? 3 : shading;
+    p.type = type;
+    CostModel *model = &costModels[precision][shading][type];
+    long long outsideSteps, wholeSteps;
+    p.posX = p.posY = 1000.0;
+    p.zoom = 1.0;
+    long long outside = timePatch(&p, model, &outsideSteps);
+    p.posX = p.posY = -2.0;
+    p.zoom = 4.0 / CALIBRATE_SIZE;
+    long long whole = timePatch(&p, model, &wholeSteps);
+    if (wholeSteps > outsideSteps * 4 && whole > outside) {
+      model->iterationNs =
+          (float)(whole - outside) / (wholeSteps - outsideSteps);
+    }
+    float pixelNs = (outside - outsideSteps * model->iterationNs) / pixels;
+    model->pixelNs = pixelNs > 0.0f ? pixelNs : 0.0f;
+    model->refined = 1;
+    if (!k) {
+      // Everything in iters is done now, so this only colors it
+      int score = 0;
+      long long started = statsClock();
+      renderRect(&p, 0, 0, p.w, p.h, 0, INT_MAX, &score);
+      colorNs = (float)(statsClock() - started) / pixels;
+    }
+  }
+  free(iters);
+  free(colors);
+}
+#endif
+
+static void prepareCosts(void) {
+  if (costsReady) {
+    return;
+  }
+  costsReady = 1;
+  for (int k = 0; k < PRECISIONS * 3 * 16; k++) {
+    int precision = k / 48;
+    int shading = k / 16 % 3;
+    costModels[precision][shading][k % 16] =
+        (CostModel){defaultPixelNs[precision][shading],
+                    defaultIterationNs[precision][shading][k % 16], 0};
+  }
+  colorNs = DEFAULT_COLOR_NS;
+}
+
+#ifndef __wasm__
+// Measure the cost model on this computer, coloring with the given palette
+// (the rest of runTimed()'s arguments don't change what things cost)
+extern void calibrateTimed(uint32_t *pallete, int palleteLength,
+                           uint32_t interiorColor, int renderMode) {
+  RenderParams p = {.pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .speed = 1.0f};
+  preparePalette(&p);
+  prepareCosts();
+  calibrateCosts(&p);
+}
+#endif
+
+// Correct the model for a call that was predicted to take predicted
+// nanoseconds and really took measured
+static void refineCosts(int precision, int shading, int type,
+                        long long predicted, long long measured) {
+  if (predicted < COST_MIN_NS || measured <= 0) {
+    return;
+  }
+  float ratio = (float)measured / predicted;
+  ratio = ratio < 0.25f ? 0.25f : ratio > 4.0f ? 4.0f : ratio;
+  CostModel *model = &costModels[precision][shading][type];
+  if (!model->refined) {
+    // The first measurement is all there is to go on, for this pair and every
+    // other one nobody has measured either
+    for (int k = 0; k < PRECISIONS * 3 * 16; k++) {
+      CostModel *other = &costModels[k / 48][k / 16 % 3][k % 16];
+      if (!other->refined && other != model) {
+        other->pixelNs *= ratio;
+        other->iterationNs *= ratio;
+      }
+    }
+    colorNs *= ratio;
+    model->pixelNs *= ratio;
+    model->iterationNs *= ratio;
+    model->refined = 1;
+    return;
+  }
+  float factor = 1.0f + COST_LEARNING * (ratio - 1.0f);
+  model->pixelNs *= factor;
+  model->iterationNs *= factor;
+}
+
+// run(), but with a time slice in microseconds instead of max
+extern int runTimed(int type, int w, int h, int pixel, double posX,
+                    double posY, double zoom, double slice, float *iters,
+                    uint32_t *colors, int iterations, uint32_t *pallete,
+                    int palleteLength, uint32_t interiorColor, int renderMode,
+                    int darkenEffect, float speed, float flowAmount) {
+  RenderParams p = {.type = type,
+                    .w = w,
+                    .h = h,
+                    .posX = posX,
+                    .posY = posY,
+                    .zoom = zoom,
+                    .iters = iters,
+                    .colors = colors,
+                    .iterations = iterations,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .posXLow = positionLowX,
+                    .posYLow = positionLowY,
+                    .forcedPrecision = forcedPrecision,
+                    .julia = juliaDefault,
+                    .stats = renderStats,
+                    .generation = currentGeneration(),
+                    .timed = 1};
+  preparePalette(&p);
+  prepareCosts();
+  // (The score is an int of nanoseconds, so slices stop at about a second)
+  double budget = slice * 1000.0;
+  int max = budget < (1 << 30) ? (int)budget : 1 << 30;
+  int score = 0;
+  long long started = statsClock();
+  int result = renderRect(&p, 0, 0, w, h, pixel, max, &score);
+  lastPrecision = precisionOf(&p, 0, 0, w, h);
+  lastShading = shadingOf(darkenEffect);
+  lastType = type;
+  lastPredicted = score;
+#ifndef __wasm__
+  refineCosts(lastPrecision, lastShading, lastType, lastPredicted,
+              statsClock() - started);
+  lastShading = -1;
+#endif
+  return result;
+}
+
+// Tell the cost model how long the last call to runTimed() really took, in
+// microseconds. Native builds time themselves, so this is only for WASM.
+extern void reportElapsed(double microseconds) {
+  if (lastShading < 0) {
+    return;
+  }
+  refineCosts(lastPrecision, lastShading, lastType, lastPredicted,
+              (long long)(microseconds * 1000.0));
+  lastShading = -1;
+}
+
+// -----
+
+// Mariani-Silver subdivision: work out the border of a rectangle, and if every
+// pixel on it is in the same band (all interior, or the same whole number of
+// iterations) assume the inside is too and fill it in without iterating.
+// Otherwise split the rectangle in two and try again. It's an approximation,
+// for every formula, in two ways. A filament thinner than a pixel can slip
+// between two border samples, so now and then a filled pixel is interior (or
+// in a band) where run() would have it escape; that's a handful of pixels a
+// frame at most. And on purpose, the filled pixels get smooth counts and
+// shading blended from the border (see fillRect()) rather than their own, so
+// the colors inside are close to run()'s but mostly not the same. On the
+// overview that's a few percent of the pixels, a few levels off; on deeper
+// views with steep color gradients it can be a quarter of them (the seahorse
+// valley at 800 iterations in renderMode 1, for mand7 and ship4), and some by
+// over 100 levels. fractal_bench --check keeps count.
+
+// Rectangles smaller than this just get rendered normally
+#define SUBDIVIDE_MIN 6
+// A band can go all the way around a bulb (or the whole set), so only trust it
+// for rectangles smaller than this. Interior areas are trusted at any size.
+#define SUBDIVIDE_BAND_MAX 64
+
+// The band of the flow color (a count of exactly 1.0). Counts between 1 and 2
+// are band 1, so it needs one that no count can have.
+#define FLOW_BAND -1.0f
+
+// Which band a pixel is in, for comparing borders. The flow color gets its own
+// so it never gets blended with anything else.
+static inline float bandOf(float t) {
+  if (t == 1.0f) {
+    return FLOW_BAND;
+  }
+  return t == -999.0f ? t : (float)(int)t;
+}
+
+// Fill the inside of a rectangle from its border. Interior is just copied, but
+// the smooth iteration counts (and shading) are blended from the four sides so
+// the colors still flow across it.
+static void fillRect(const RenderParams *p, int x0, int y0, int x1, int y1) {
+  int w = p->w;
+  int planeSize = w * p->h;
+  float *iters = p->iters;
+  float speed1 = sqrtf(sqrtf(p->speed));
+  float speed2 = 0.035f * p->speed;
+  float band = bandOf(iters[y0 * w + x0]);
+  int flat = band == -999.0f || band == FLOW_BAND;
+  float spanX = x1 - 1 - x0;
+  float spanY = y1 - 1 - y0;
+  for (int y = y0 + 1; y < y1 - 1; y++) {
+    float v = (y - y0) / spanY;
+    int left = y * w + x0;
+    int right = y * w + x1 - 1;
+    for (int x = x0 + 1; x < x1 - 1; x++) {
+      int index = y * w + x;
+      float t = band == FLOW_BAND ? 1.0f : band;
+      float l = 0;
+      if (!flat) {
+        float u = (x - x0) / spanX;
+        int top = y0 * w + x;
+        int bottom = (y1 - 1) * w + x;
+        t = 0.5f * (iters[left] + (iters[right] - iters[left]) * u +
+                    iters[top] + (iters[bottom] - iters[top]) * v);
+        float *shade = iters + planeSize;
+        l = 0.5f * (shade[left] + (shade[right] - shade[left]) * u +
+                    shade[top] + (shade[bottom] - shade[top]) * v);
+        // Rounding could push it just outside the band
+        t = t < band ? band : t;
+        iters[planeSize + index] = l;
+      }
+      iters[index] = t;
+      p->colors[index] = colorPixel(p, t, l, speed1, speed2);
+    }
+  }
+}
+
+// Render [x0, x1) x [y0, y1) by subdivision. Returns 1 if *score went over max
+// before it finished. Everything it computes is kept in iters, so starting
+// again from the top only repeats the (cheap) border checks.
+static int renderSubdivided(const RenderParams *p, int x0, int y0, int x1,
+                            int y1, int max, int *score) {
+  // Each split leaves at most one rectangle waiting, and the sizes halve
+  int stack[128][4];
+  int top = 1;
+  stack[0][0] = x0, stack[0][1] = y0, stack[0][2] = x1, stack[0][3] = y1;
+  while (top) {
+    top--;
+    int ax = stack[top][0], ay = stack[top][1];
+    int bx = stack[top][2], by = stack[top][3];
+    if (bx - ax < SUBDIVIDE_MIN || by - ay < SUBDIVIDE_MIN) {
+      if (renderRect(p, ax, ay, bx, by, 0, max, score) != -1) {
+        return 1;
+      }
+      continue;
+    }
+    // The border, as four strips
+    if (renderRect(p, ax, ay, bx, ay + 1, 0, max, score) != -1 ||
+        renderRect(p, ax, by - 1, bx, by, 0, max, score) != -1 ||
+        renderRect(p, ax, ay + 1, ax + 1, by - 1, 0, max, score) != -1 ||
+        renderRect(p, bx - 1, ay + 1, bx, by - 1, 0, max, score) != -1) {
+      return 1;
+    }
+    float *iters = p->iters;
+    int w = p->w;
+    float band = bandOf(iters[ay * w + ax]);
+    int same = 1;
+    for (int x = ax; x < bx && same; x++) {
+      same = bandOf(iters[ay * w + x]) == band &&
+             bandOf(iters[(by - 1) * w + x]) == band;
+    }
+    for (int y = ay + 1; y < by - 1 && same; y++) {
+      same = bandOf(iters[y * w + ax]) == band &&
+             bandOf(iters[y * w + bx - 1]) == band;
+    }
+    if (same && (band == -999.0f || (bx - ax <= SUBDIVIDE_BAND_MAX &&
+                                     by - ay <= SUBDIVIDE_BAND_MAX))) {
+      fillRect(p, ax, ay, bx, by);
+      continue;
+    }
+    // Split across the longer side. The halves share the line in the middle,
+    // which only gets computed once.
+    if (bx - ax >= by - ay) {
+      int mid = (ax + bx) / 2;
+      int next[2][4] = {{mid, ay, bx, by}, {ax, ay, mid + 1, by}};
+      for (int k = 0; k < 2; k++) {
+        for (int c = 0; c < 4; c++) {
+          stack[top][c] = next[k][c];
+        }
+        top++;
+      }
+    } else {
+      int mid = (ay + by) / 2;
+      int next[2][4] = {{ax, mid, bx, by}, {ax, ay, bx, mid + 1}};
+      for (int k = 0; k < 2; k++) {
+        for (int c = 0; c < 4; c++) {
+          stack[top][c] = next[k][c];
+        }
+        top++;
+      }
     }
   }
-  return -999.0f;
+  return 0;
 }
 
-float mand5S(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double fi = si * si;
-  double dr = 1;
-  double di = 0;
-  for (int n = 1; n <= iterations; n++) {
-    double tempdr = 5.0 * (sr * sr - 6 * sr * si + fi) * dr -
-                    20 * r * i * (sr - si) * di + 1.0;
-    di = 5.0 * (sr * sr - 6 * sr * si + fi) * di + 20 * r * i * (sr - si) * dr;
-    dr = tempdr;
-    i = i * (sr * (5.0 * sr - 10.0 * si) + fi) + y;
-    r = r * (sr * (sr - 10.0 * si) + 5.0 * fi) + x;
-    sr = r * r;
-    si = i * i;
-    fi = si * si;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.43067655807339306f;
-      double sqm = dr * dr + di * di;
-      double ur = (r * dr + i * di) / sqm;
-      double ui = (i * dr - r * di) / sqm;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : (t * 0.4f);
-      return result;
+// Same as run(), but skips over areas that are all one band (see above). It
+// can't resume from a particular pixel, so it returns 0 rather than an index
+// when it runs out of time, and picks up from what's already in iters.
+extern int runSubdivided(int type, int w, int h, int pixel, double posX,
+                         double posY, double zoom, int max, float *iters,
+                         uint32_t *colors, int iterations, uint32_t *pallete,
+                         int palleteLength, uint32_t interiorColor,
+                         int renderMode, int darkenEffect, float speed,
+                         float flowAmount) {
+  RenderParams p = {.type = type,
+                    .w = w,
+                    .h = h,
+                    .posX = posX,
+                    .posY = posY,
+                    .zoom = zoom,
+                    .iters = iters,
+                    .colors = colors,
+                    .iterations = iterations,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .posXLow = positionLowX,
+                    .posYLow = positionLowY,
+                    .forcedPrecision = forcedPrecision,
+                    .julia = juliaDefault,
+                    .stats = renderStats,
+                    .generation = currentGeneration()};
+  int score = 0;
+  (void)pixel;
+  preparePalette(&p);
+  return renderSubdivided(&p, 0, 0, w, h, max, &score) ? 0 : -1;
+}
+
+// -----
+
+// Progressive rendering: rather than filling the screen from the top down, do
+// every 8th pixel of every 8th row first and blow each one up into an 8x8
+// block, so there's a rough picture of the whole frame after 1/64 of the work.
+// Then fill in the lattice at 4, 2 and finally 1, with each pass only
+// computing the pixels the passes before it skipped.
+
+#define PROGRESSIVE_PASSES 4
+
+static inline void fillBlock(const RenderParams *p, int x, int y, int size,
+                             uint32_t color) {
+  int x1 = x + size < p->w ? x + size : p->w;
+  int y1 = y + size < p->h ? y + size : p->h;
+  for (int row = y; row < y1; row++) {
+    uint32_t *colors = p->colors + row * p->w;
+    for (int column = x; column < x1; column++) {
+      colors[column] = color;
     }
   }
-  return -999.0f;
 }
 
-float mand6S(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double fr = sr * sr;
-  double fi = si * si;
-  for (int n = 1; n <= iterations; n++) {
-    i = r * i * (6.0 * (fr + fi) - 20.0 * sr * si) + y;
-    r = sr * (fr + 15.0 * fi) - si * (15.0 * fr + fi) + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.38685280723454163f;
-      return result;
+// resume is pass * w * h + the index of the next pixel in that pass. Returns
+// where to resume from, or -1 when every pass is done.
+static inline __attribute__((always_inline)) int renderProgressiveLoop(
+    const RenderParams *p, int resume, int max, int *score,
+    const int counting) {
+  int w = p->w;
+  int planeSize = w * p->h;
+  int biggerIterations = p->iterations + 2;
+  float *iters = p->iters;
+  float speed1 = sqrtf(sqrtf(p->speed));
+  float speed2 = 0.035f * p->speed;
+  Kernels kernels = pickKernels(p, 0, 0, w, p->h);
+  LaneKernel lanes = kernels.lanes;
+  PixelKernel single = kernels.single;
+  int deep = kernels.precision == PRECISION_DOUBLE_DOUBLE;
+  RenderStats counts;
+  RenderStats *tally = NULL;
+  int steps[FLOAT_LANES];
+  int scoreBefore = *score;
+  long long started = 0;
+  if (counting) {
+    counts = (RenderStats){0};
+    tally = &counts;
+    started = statsClock();
+  }
+  // (The score is checked after every batch)
+  max = capBudget(max, (long long)FLOAT_LANES * (p->iterations + 13));
+
+  for (int pass = resume / planeSize; pass < PROGRESSIVE_PASSES; pass++) {
+    int step = 1 << (PROGRESSIVE_PASSES - 1 - pass);
+    int start = pass == resume / planeSize ? resume % planeSize : 0;
+    for (int y = start / w; y < p->h; y++) {
+      if (y % step) {
+        continue;
+      }
+      // Rows that an earlier pass went through already have every other
+      // pixel done
+      int old = pass && y % (2 * step) == 0;
+      int xStep = old ? 2 * step : step;
+      int x = old ? step : 0;
+      if (y == start / w && start % w > x) {
+        x += (start % w - x + xStep - 1) / xStep * xStep;
+      }
+      double coordinateY = p->posY + y * p->zoom;
+      double yLow =
+          deep ? lowPart(p->posY, y * p->zoom, coordinateY, p->posYLow) : 0;
+      while (x < w) {
+        // Gather the next few pixels that still need iterating
+        int columns[FLOAT_LANES];
+        double xs[FLOAT_LANES];
+        double xsLow[FLOAT_LANES];
+        double ys[FLOAT_LANES];
+        double ysLow[FLOAT_LANES];
+        float batch[FLOAT_LANES];
+        float shade[FLOAT_LANES];
+        int count = 0;
+        for (; x < w && count < kernels.width; x += xStep) {
+          int index = y * w + x;
+          float t = iters[index];
+          if (t) {
+            fillBlock(p, x, y, step,
+                      colorPixel(p, t, iters[planeSize + index], speed1,
+                                 speed2));
+            continue;
+          }
+          columns[count] = x;
+          double offset = x * p->zoom;
+          xs[count] = p->posX + offset;
+          xsLow[count] =
+              deep ? lowPart(p->posX, offset, xs[count], p->posXLow) : 0;
+          ys[count] = coordinateY;
+          ysLow[count] = yLow;
+          shade[count] = iters[planeSize + index];
+          count++;
+        }
+        long long clock = tally ? statsClock() : 0;
+        if (count > 1 || (count && !single)) {
+          lanes(p->iterations, &p->julia, xs, xsLow, ys, ysLow, count, batch,
+                shade, tally ? steps : NULL);
+        } else if (count) {
+          batch[0] = single(p->iterations, &p->julia, xs[0], coordinateY,
+                            shade, tally ? steps : NULL);
+        }
+        if (tally) {
+          tally->formulaNanoseconds += statsClock() - clock;
+        }
+        for (int k = 0; k < count; k++) {
+          int index = y * w + columns[k];
+          if (tally) {
+            tallyPixel(tally, p->stats->cost, index, batch[k], steps[k],
+                       p->iterations);
+          }
+          float n = settlePixel(batch[k], biggerIterations, score);
+          iters[index] = n;
+          iters[planeSize + index] = shade[k];
+          fillBlock(p, columns[k], y, step,
+                    colorPixel(p, n, shade[k], speed1, speed2));
+        }
+        if (*score > max || cancelled(p)) {
+          int next = pass * planeSize + y * w + (x < w ? x : w);
+          if (tally) {
+            finishTally(p, tally, *score - scoreBefore, started);
+          }
+          return next < PROGRESSIVE_PASSES * planeSize ? next : -1;
+        }
+      }
     }
-    fr = sr * sr;
-    fi = si * si;
   }
-  return -999.0f;
+  if (tally) {
+    finishTally(p, tally, *score - scoreBefore, started);
+  }
+  return -1;
 }
 
-float mand7S(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double fr = sr * sr;
-  double fi = si * si;
-  for (int n = 1; n <= iterations; n++) {
-    r = r * (fr * (sr - 21.0 * si) + fi * (35.0 * sr - 7.0 * si)) + x;
-    i = i * (fr * (7.0 * sr - 35.0 * si) + fi * (21.0 * sr - si)) + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.3562071871080222f;
-      return result;
-    }
-    fr = sr * sr;
-    fi = si * si;
+// (With its own copy for statistics, like renderRect())
+static int renderProgressive(const RenderParams *p, int resume, int max,
+                             int *score) {
+  if (p->stats) {
+    return renderProgressiveLoop(p, resume, max, score, 1);
   }
-  return -999.0f;
+  return renderProgressiveLoop(p, resume, max, score, 0);
 }
 
-float shipS(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double dr = 1;
-  double di = 0;
-  for (int n = 1; n <= iterations; n++) {
-    double tempdr = 2.0 * (dr * r - di * i) + 1.0;
-    di = 2.0 * (dr * i + di * r);
-    dr = tempdr;
-    i = fabs(2.0 * r * i) + y;
-    r = sr - si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      double sqm = dr * dr + di * di;
-      double ur = (r * dr + i * di) / sqm;
-      double ui = (i * dr - r * di) / sqm;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : (t * 0.4f);
-      return result;
-    }
+// Same as run(), but coarse to fine (see above). pixel is 0 to start a frame,
+// or whatever the last call returned to carry on with it.
+extern int runProgressive(int type, int w, int h, int pixel, double posX,
+                          double posY, double zoom, int max, float *iters,
+                          uint32_t *colors, int iterations, uint32_t *pallete,
+                          int palleteLength, uint32_t interiorColor,
+                          int renderMode, int darkenEffect, float speed,
+                          float flowAmount) {
+  RenderParams p = {.type = type,
+                    .w = w,
+                    .h = h,
+                    .posX = posX,
+                    .posY = posY,
+                    .zoom = zoom,
+                    .iters = iters,
+                    .colors = colors,
+                    .iterations = iterations,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .posXLow = positionLowX,
+                    .posYLow = positionLowY,
+                    .forcedPrecision = forcedPrecision,
+                    .julia = juliaDefault,
+                    .stats = renderStats,
+                    .generation = currentGeneration()};
+  int score = 0;
+  preparePalette(&p);
+  return renderProgressive(&p, pixel, max, &score);
+}
+
+// -----
+
+// Panning. Everything in iters that is still on screen after a pan is still
+// good, so rather than throwing it all away this moves it along with the view
+// and only clears the strips that came into view. The next run() recolors the
+// rest and only iterates those strips.
+//
+// (These use the builtins so WASM gets its memory.copy and memory.fill
+// instructions rather than needing a libc.)
+
+// Move a plane of 32-bit values by (dx, dy) and zero what gets uncovered
+static void shiftPlane(void *plane, int w, int h, int dx, int dy) {
+  uint32_t *values = plane;
+  int width = w - (dx < 0 ? -dx : dx);
+  int to = dx > 0 ? dx : 0;
+  int from = dx < 0 ? -dx : 0;
+  int clear = dx > 0 ? 0 : width;
+  // Go through the rows from the side the data moves towards, so none of them
+  // are overwritten before they've been moved
+  int first = dy > 0 ? h - 1 : 0;
+  int last = dy > 0 ? dy - 1 : h + dy;
+  int direction = dy > 0 ? -1 : 1;
+  for (int y = first; y != last; y += direction) {
+    uint32_t *row = values + y * w;
+    __builtin_memmove(row + to, values + (y - dy) * w + from,
+                      width * sizeof(uint32_t));
+    __builtin_memset(row + clear, 0, (w - width) * sizeof(uint32_t));
+  }
+  if (dy > 0) {
+    __builtin_memset(values, 0, dy * w * sizeof(uint32_t));
+  } else if (dy < 0) {
+    __builtin_memset(values + (h + dy) * w, 0, -dy * w * sizeof(uint32_t));
   }
-  return -999.0f;
 }
 
-float ship3S(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double dr = 1;
-  double di = 0;
-  for (int n = 1; n <= iterations; n++) {
-    double temp = 2.0 * r * i;
-    double tempdr = 3.0 * (dr * (sr - si) - di * temp) + 1.0;
-    di = 3.0 * (dr * temp + di * (sr - si));
-    dr = tempdr;
-    r = fabs(r) * (sr - 3.0 * si) + x;
-    i = fabs(i) * (3.0 * sr - si) + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.6309297535714575f;
-      double sqm = dr * dr + di * di;
-      double ur = (r * dr + i * di) / sqm;
-      double ui = (i * dr - r * di) / sqm;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : (t * 0.4f);
-      return result;
-    }
+// Shift a frame's iters (both planes) and colors by (dx, dy) pixels, so what
+// was at (x, y) is now at (x + dx, y + dy). Call it after moving the view by
+// posX -= dx * zoom and posY -= dy * zoom; the strips that came into view are
+// cleared so the next run() computes just those.
+extern void pan(int w, int h, int dx, int dy, float *iters,
+                uint32_t *colors) {
+  if (dx <= -w || dx >= w || dy <= -h || dy >= h) {
+    // Nothing is left on screen
+    __builtin_memset(iters, 0, 2 * w * h * sizeof(float));
+    return;
   }
-  return -999.0f;
+  shiftPlane(iters, w, h, dx, dy);
+  shiftPlane(iters + w * h, w, h, dx, dy);
+  shiftPlane(colors, w, h, dx, dy);
 }
 
-float ship4S(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double dr = 1;
-  double di = 0;
-  for (int n = 1; n <= iterations; n++) {
-    double temp = r * i;
-    double tempdr = 4.0 * (sr - si) * (dr * r - di * i) -
-                    8.0 * temp * (dr * i + di * r) + 1.0;
-    di = 4.0 * (sr - si) * (dr * i + di * r) + 8.0 * temp * (dr * r - di * i);
-    dr = tempdr;
-    i = fabs(4.0 * r * i) * (sr - si) + y;
-    r = sr * sr - 6.0 * sr * si + si * si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si))) * 0.5f;
-      double sqm = dr * dr + di * di;
-      double ur = (r * dr + i * di) / sqm;
-      double ui = (i * dr - r * di) / sqm;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : (t * 0.4f);
-      return result;
+// -----
+
+// Zooming by a power of two. Pixel (x, y) is at posX + x * zoom, so when the
+// zoom halves (or doubles) and the new frame starts on an old pixel, a
+// quarter of the new pixels are exactly old ones (or every other old pixel,
+// across and down, is exactly a new one, and they land next to each other).
+// reproject() carries those over from the last frame, and fills colors in for
+// everything else from them so there's something to look at until run() gets
+// there.
+
+// Color of the old frame at a fractional position, blending the four pixels
+// around it
+static uint32_t sampleColors(const uint32_t *colors, int w, int h, float x,
+                             float y) {
+  int x0 = x;
+  int y0 = y;
+  int x1 = x0 + 1 < w ? x0 + 1 : x0;
+  int y1 = y0 + 1 < h ? y0 + 1 : y0;
+  uint32_t ax = (x - x0) * 255.0f;
+  uint32_t ay = (y - y0) * 255.0f;
+  return mix(mix(colors[y0 * w + x0], colors[y0 * w + x1], ax),
+             mix(colors[y1 * w + x0], colors[y1 * w + x1], ax), ay);
+}
+
+// level > 0 zooms in by 2^level, with the new frame starting at the old pixel
+// (originX, originY): posX += originX * zoom and then zoom /= 2^level. level <
+// 0 zooms out by 2^-level, with the old frame's first pixel landing on the new
+// pixel (originX, originY): zoom *= 2^-level and then posX -= originX * zoom
+// (so (w - (w >> -level)) / 2 keeps it centered). The old and new buffers are
+// the same size and mustn't overlap. Pixels that didn't carry over are left at
+// 0 in iters, for the next run(). level has to be between -30 and 30 (past
+// that, a pixel or two would carry over at most); anything further carries
+// nothing over.
+extern void reproject(int w, int h, int level, int originX, int originY,
+                      const float *oldIters, const uint32_t *oldColors,
+                      float *iters, uint32_t *colors) {
+  int planeSize = w * h;
+  if (level < -30 || level > 30) {
+    for (int index = 0; index < planeSize; index++) {
+      iters[index] = 0;
+      iters[planeSize + index] = 0;
+      colors[index] = 0;
+    }
+    return;
+  }
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      int index = y * w + x;
+      // (In 64 bits, as origins far off the frame would overflow)
+      int64_t oldX, oldY;
+      int exact;
+      if (level >= 0) {
+        int mask = (1 << level) - 1;
+        oldX = (int64_t)originX + (x >> level);
+        oldY = (int64_t)originY + (y >> level);
+        exact = !(x & mask) && !(y & mask);
+      } else {
+        oldX = ((int64_t)x - originX) * (1 << -level);
+        oldY = ((int64_t)y - originY) * (1 << -level);
+        exact = x >= originX && y >= originY;
+      }
+      int inside = oldX >= 0 && oldX < w && oldY >= 0 && oldY < h;
+      if (exact && inside) {
+        int oldIndex = (int)oldY * w + (int)oldX;
+        iters[index] = oldIters[oldIndex];
+        iters[planeSize + index] = oldIters[planeSize + oldIndex];
+        colors[index] = oldColors[oldIndex];
+        continue;
+      }
+      iters[index] = 0;
+      iters[planeSize + index] = 0;
+      if (level > 0 && inside) {
+        float scale = 1.0f / (1 << level);
+        colors[index] = sampleColors(oldColors, w, h, originX + x * scale,
+                                     originY + y * scale);
+      } else {
+        colors[index] = 0;
+      }
     }
   }
-  return -999.0f;
 }
 
-float celtS(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = 2.0 * r * i + y;
-    r = fabs(sr - si) + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
-    }
+// -----
+
+// Tile cache. People keep going back to the same places, and every time they
+// do, run() iterates every pixel again. Given some memory with setTileCache(),
+// runCached() keeps the iteration counts and shading of what it renders in
+// TILE_CACHE_SIZE pixel square tiles on a grid fixed to the plane, and fills
+// each tile of the frame from there before iterating whatever is still
+// missing. That needs the frame to sit on the grid: zoom has to be a power of
+// two, 2^-level, and posX and posY whole pixels at that zoom (anything else is
+// just rendered like run() does). Tiles are keyed by formula, shading mode,
+// iterations, level and where they are, and once the memory is full the least
+// recently used tile makes room for the next one. Only iters is kept, so the
+// colors come from the palette, speed and flow of each call like they do for
+// pixels pan() or reproject() carried over, and changing those doesn't lose
+// any tiles.
+
+#define TILE_CACHE_SIZE 64
+#define TILE_CACHE_PIXELS (TILE_CACHE_SIZE * TILE_CACHE_SIZE)
+
+typedef struct {
+  int type;
+  int shading;
+  int iterations;
+  // (A forced precision gives slightly different pixels, so it counts too)
+  int precision;
+  // The Julia set's c (see setJulia()), or 0 for the parameter plane
+  int julia;
+  double juliaX;
+  double juliaY;
+  int level;
+  // Which tile of the grid, counting from the origin
+  int64_t x;
+  int64_t y;
+} TileKey;
+
+typedef struct {
+  TileKey key;
+  // The tiles used just after and just before this one, and the next one in
+  // the same bucket (-1 for none)
+  int newer;
+  int older;
+  int next;
+} TileEntry;
+
+// The cache lives in the memory handed to setTileCache(): the entries, then
+// the buckets, then both planes of every tile
+typedef struct {
+  TileEntry *entries;
+  int *buckets;
+  float *planes;
+  int capacity;
+  int used;
+  // A power of two
+  int bucketCount;
+  int newest;
+  int oldest;
+} TileCache;
+
+static TileCache tileCache;
+
+// Cache tiles in the bytes at memory (8-byte aligned), which have to stay
+// around until the next call. Returns how many tiles fit. Any tiles from
+// before are forgotten, and NULL (or too few bytes) turns the cache off.
+extern int setTileCache(void *memory, int bytes) {
+  int tileBytes = sizeof(TileEntry) + 2 * sizeof(int) +
+                  2 * TILE_CACHE_PIXELS * sizeof(float);
+  int capacity = memory ? bytes / tileBytes : 0;
+  if (!capacity) {
+    tileCache = (TileCache){0};
+    return 0;
   }
-  return -999.0f;
+  int bucketCount = 1;
+  while (bucketCount < capacity) {
+    bucketCount *= 2;
+  }
+  tileCache = (TileCache){.entries = memory,
+                          .buckets = (int *)((TileEntry *)memory + capacity),
+                          .capacity = capacity,
+                          .bucketCount = bucketCount,
+                          .newest = -1,
+                          .oldest = -1};
+  tileCache.planes = (float *)(tileCache.buckets + bucketCount);
+  for (int k = 0; k < bucketCount; k++) {
+    tileCache.buckets[k] = -1;
+  }
+  return capacity;
 }
 
-float prmbS(int iterations, double x, double y, float *ptr) {
-  double r = fabs(x);
-  double i = -y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    double tr = 2.0 * r * i;
-    r = fabs(sr - i * i + x);
-    i = -tr - y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
+static inline uint32_t hashTile(const TileKey *key) {
+  uint64_t hash = (uint64_t)key->x * 0x9e3779b97f4a7c15ULL;
+  hash ^= (uint64_t)key->y + 0x7f4a7c159e3779b9ULL + (hash << 6) + (hash >> 2);
+  hash ^= (uint64_t)(key->level * 31 + key->type) * 0xff51afd7ed558ccdULL;
+  hash ^= (uint64_t)(key->iterations * 7 + key->shading * 3 +
+                     key->precision) *
+          0xc4ceb9fe1a85ec53ULL;
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static inline int sameTile(const TileKey *a, const TileKey *b) {
+  return a->x == b->x && a->y == b->y && a->level == b->level &&
+         a->type == b->type && a->shading == b->shading &&
+         a->iterations == b->iterations && a->precision == b->precision &&
+         a->julia == b->julia && a->juliaX == b->juliaX &&
+         a->juliaY == b->juliaY;
+}
+
+// Take a tile out of the recently used list
+static void unlinkTile(int entry) {
+  TileEntry *tile = &tileCache.entries[entry];
+  if (tile->newer >= 0) {
+    tileCache.entries[tile->newer].older = tile->older;
+  } else {
+    tileCache.newest = tile->older;
+  }
+  if (tile->older >= 0) {
+    tileCache.entries[tile->older].newer = tile->newer;
+  } else {
+    tileCache.oldest = tile->newer;
+  }
+}
+
+// Put a tile at the front of the recently used list
+static void linkTile(int entry) {
+  TileEntry *tile = &tileCache.entries[entry];
+  tile->newer = -1;
+  tile->older = tileCache.newest;
+  if (tileCache.newest >= 0) {
+    tileCache.entries[tileCache.newest].newer = entry;
+  } else {
+    tileCache.oldest = entry;
+  }
+  tileCache.newest = entry;
+}
+
+// The tile for key, which becomes the most recently used one. A tile that
+// isn't cached yet is added (all 0, as nothing in it has been computed),
+// pushing out the least recently used one if there's no room.
+static int cachedTile(const TileKey *key) {
+  int *bucket =
+      &tileCache.buckets[hashTile(key) & (tileCache.bucketCount - 1)];
+  for (int entry = *bucket; entry >= 0;
+       entry = tileCache.entries[entry].next) {
+    if (sameTile(&tileCache.entries[entry].key, key)) {
+      unlinkTile(entry);
+      linkTile(entry);
+      return entry;
     }
   }
-  return -999.0f;
+  int entry;
+  if (tileCache.used < tileCache.capacity) {
+    entry = tileCache.used++;
+  } else {
+    entry = tileCache.oldest;
+    unlinkTile(entry);
+    const TileKey *old = &tileCache.entries[entry].key;
+    int *link =
+        &tileCache.buckets[hashTile(old) & (tileCache.bucketCount - 1)];
+    while (*link != entry) {
+      link = &tileCache.entries[*link].next;
+    }
+    *link = tileCache.entries[entry].next;
+  }
+  tileCache.entries[entry].key = *key;
+  tileCache.entries[entry].next = *bucket;
+  *bucket = entry;
+  linkTile(entry);
+  float *plane = tileCache.planes + (size_t)entry * 2 * TILE_CACHE_PIXELS;
+  for (int k = 0; k < 2 * TILE_CACHE_PIXELS; k++) {
+    plane[k] = 0;
+  }
+  return entry;
 }
 
-float buffS(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    r = fabs(r);
-    i = fabs(i);
-    double tr = 2.0 * r * i;
-    r = sr - si - r + x;
-    i = tr - i + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
+// Whether p's frame sits on the tile grid, and if so its level and which
+// pixel of the grid it starts at
+static int onTileGrid(const RenderParams *p, int *level, int64_t *originX,
+                      int64_t *originY) {
+  union {
+    double number;
+    uint64_t integer;
+  } zoom = {p->zoom};
+  int exponent = (int)(zoom.integer >> 52);
+  // (Positive, normal and nothing but the exponent)
+  if (exponent <= 0 || exponent >= 0x7ff ||
+      (zoom.integer & 0xfffffffffffffULL) || p->posXLow || p->posYLow) {
+    return 0;
+  }
+  double x = p->posX / p->zoom;
+  double y = p->posY / p->zoom;
+  double limit = 1e15;
+  if (!(fabs(x) < limit && fabs(y) < limit) || x != (double)(int64_t)x ||
+      y != (double)(int64_t)y) {
+    return 0;
+  }
+  *level = 1023 - exponent;
+  *originX = (int64_t)x;
+  *originY = (int64_t)y;
+  return 1;
+}
+
+// Which tile a pixel of the grid is in (rounding down)
+static inline int64_t tileOf(int64_t pixel) {
+  return pixel >= 0 ? pixel / TILE_CACHE_SIZE
+                    : -((-pixel + TILE_CACHE_SIZE - 1) / TILE_CACHE_SIZE);
+}
+
+// Copy the pixels of [x0, x1) x [y0, y1) between a frame's iters and a tile
+// (both planes) whose first pixel is at (left, top) in the frame, into the
+// frame if intoFrame is set and into the tile otherwise. Only computed pixels
+// are copied, and only over ones that aren't.
+static void copyTile(const RenderParams *p, float *plane, int left, int top,
+                     int x0, int y0, int x1, int y1, int intoFrame) {
+  int planeSize = p->w * p->h;
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++) {
+      int index = y * p->w + x;
+      int cell = (y - top) * TILE_CACHE_SIZE + (x - left);
+      float *from = intoFrame ? plane + cell : p->iters + index;
+      float *to = intoFrame ? p->iters + index : plane + cell;
+      int shadeFrom = intoFrame ? TILE_CACHE_PIXELS : planeSize;
+      int shadeTo = intoFrame ? planeSize : TILE_CACHE_PIXELS;
+      if (*from && !*to) {
+        *to = *from;
+        to[shadeTo] = from[shadeFrom];
+      }
     }
   }
-  return -999.0f;
 }
 
-float tricS(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = -2.0 * r * i + y;
-    r = sr - si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
+// Same as run(), but through the tile cache (see above). The frame is done one
+// tile at a time, so the index this returns to pick back up from counts
+// TILE_CACHE_PIXELS for every tile before the one it stopped in.
+extern int runCached(int type, int w, int h, int pixel, double posX,
+                     double posY, double zoom, int max, float *iters,
+                     uint32_t *colors, int iterations, uint32_t *pallete,
+                     int palleteLength, uint32_t interiorColor, int renderMode,
+                     int darkenEffect, float speed, float flowAmount) {
+  RenderParams p = {.type = type,
+                    .w = w,
+                    .h = h,
+                    .posX = posX,
+                    .posY = posY,
+                    .zoom = zoom,
+                    .iters = iters,
+                    .colors = colors,
+                    .iterations = iterations,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .posXLow = positionLowX,
+                    .posYLow = positionLowY,
+                    .forcedPrecision = forcedPrecision,
+                    .julia = juliaDefault,
+                    .stats = renderStats,
+                    .generation = currentGeneration()};
+  int score = 0;
+  preparePalette(&p);
+  TileKey key = {.type = type,
+                 .shading = shadingOf(darkenEffect),
+                 .iterations = iterations,
+                 .precision = p.forcedPrecision,
+                 .julia = p.julia.on,
+                 .juliaX = p.julia.x,
+                 .juliaY = p.julia.y};
+  int64_t originX, originY;
+  if (!tileCache.capacity || !onTileGrid(&p, &key.level, &originX, &originY)) {
+    return renderRect(&p, 0, 0, w, h, pixel, max, &score);
+  }
+  int64_t firstX = tileOf(originX);
+  int64_t firstY = tileOf(originY);
+  int columns = (int)(tileOf(originX + w - 1) - firstX + 1);
+  int rows = (int)(tileOf(originY + h - 1) - firstY + 1);
+  int first = pixel / TILE_CACHE_PIXELS;
+  for (int tile = first; tile < columns * rows; tile++) {
+    key.x = firstX + tile % columns;
+    key.y = firstY + tile / columns;
+    // Where the tile starts in the frame, and the part of it that's on screen
+    int left = (int)(key.x * TILE_CACHE_SIZE - originX);
+    int top = (int)(key.y * TILE_CACHE_SIZE - originY);
+    int x0 = left > 0 ? left : 0;
+    int y0 = top > 0 ? top : 0;
+    int x1 = left + TILE_CACHE_SIZE < w ? left + TILE_CACHE_SIZE : w;
+    int y1 = top + TILE_CACHE_SIZE < h ? top + TILE_CACHE_SIZE : h;
+    float *plane =
+        tileCache.planes + (size_t)cachedTile(&key) * 2 * TILE_CACHE_PIXELS;
+    copyTile(&p, plane, left, top, x0, y0, x1, y1, 1);
+    int resume =
+        renderRect(&p, x0, y0, x1, y1,
+                   tile == first ? pixel % TILE_CACHE_PIXELS : 0, max, &score);
+    // (Even a tile that isn't finished is worth keeping what it has so far)
+    copyTile(&p, plane, left, top, x0, y0, x1, y1, 0);
+    if (resume >= 0) {
+      return tile * TILE_CACHE_PIXELS + resume;
     }
   }
-  return -999.0f;
+  return -1;
 }
 
-float mbbsS(int iterations, double x, double y, float *ptr) {
-  int exchange = 1;
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    if (exchange++ == 10) {
-      exchange = 1;
-      i = fabs(2.0 * r * i) + y;
-      r = sr - si + x;
+// -----
+
+// Recoloring. Changing the palette, speed or flow only changes the colors, and
+// every pixel's iteration count and shading are still in iters, so recolor()
+// just redoes the coloring without going near the formulas (or the score). It
+// works on LANES pixels at a time: the palette position is worked out across
+// lanes, the colors are fetched from the palette table a lane at a time, and
+// then they're darkened across lanes again. The colors are identical to
+// run()'s, as both go through the same table (which can be 1 off from
+// getPallete(), see above).
+
+typedef float vfloat __attribute__((vector_size(LANES * sizeof(float))));
+typedef int32_t vint __attribute__((vector_size(LANES * sizeof(float))));
+typedef uint32_t vuint __attribute__((vector_size(LANES * sizeof(float))));
+// A lane group of the compact field
+typedef uint16_t vcount
+    __attribute__((vector_size(LANES * sizeof(uint16_t))));
+typedef uint8_t vshade __attribute__((vector_size(LANES * sizeof(uint8_t))));
+
+typedef void (*RecolorKernel)(const RenderParams *p, int start, int end);
+
+// These are macros (GNU statement expressions) rather than functions, since
+// GCC warns about the ABI of vector return values otherwise
+
+// flog2() across lanes
+#define vflog2(n)                                                      \
+  ({                                                                   \
+    vuint integer_ = (vuint)(n);                                       \
+    vfloat number_ = (vfloat)((integer_ & 0x7fffff) | 0x3f000000);     \
+    vfloat y_ = __builtin_convertvector(integer_, vfloat);             \
+    y_ *= 1.19209289e-7f;                                              \
+    y_ - 124.225517f - 1.4980303f * number_ -                          \
+        1.72588f / (0.35208873f + number_);                            \
+  })
+
+// mix() across lanes (0xffffff01 and 0xffff0001 are -0xff and -0xffff)
+#define vmix(colorStart, colorEnd, a)                                  \
+  ({                                                                   \
+    vuint start_ = (colorStart);                                       \
+    vuint end_ = (colorEnd);                                           \
+    vuint a_ = (a);                                                    \
+    vuint reverse_ = 0xff - a_;                                        \
+    ((((start_ & 0xff) * reverse_ + (end_ & 0xff) * a_) >> 8)) ^       \
+        (((((start_ >> 8) & 0xff) * reverse_ +                         \
+           ((end_ >> 8) & 0xff) * a_)) &                               \
+         0xffffff01) ^                                                 \
+        (((((start_ >> 16) & 0xff) * reverse_ +                        \
+           ((end_ >> 16) & 0xff) * a_)                                 \
+          << 8) &                                                      \
+         0xffff0001) ^                                                 \
+        0xff000000;                                                    \
+  })
+
+// mixBlack() across lanes
+#define vmixBlack(colorStart, a)                                            \
+  ({                                                                        \
+    vuint start_ = (colorStart);                                            \
+    vuint a_ = (a);                                                         \
+    vuint reverse_ = 0xff - a_;                                             \
+    vuint color_ = ((((start_ & 0xff) * reverse_) >> 8)) ^                  \
+                   (((((start_ >> 8) & 0xff) * reverse_)) & 0xffffff01) ^   \
+                   (((((start_ >> 16) & 0xff) * reverse_) << 8) &           \
+                    0xffff0001) ^                                           \
+                   0xff000000;                                              \
+    vuint keep_ = (vuint)(a_ == 0);                                         \
+    (start_ & keep_) | (color_ & ~keep_);                                   \
+  })
+
+// Color the pixels [start, end) of a frame from what's in iters (or the
+// compact field, if compact is set)
+static inline __attribute__((always_inline)) void recolorLoop(
+    const RenderParams *p, int start, int end, const int compact) {
+  const float *iters = p->iters;
+  const float *shade = compact ? NULL : iters + p->w * p->h;
+  float unit = 1.0f / (1 << p->countFraction);
+  uint32_t *pallete = p->pallete;
+  int length = p->palleteLength;
+  float speed1 = sqrtf(sqrtf(p->speed));
+  float speed2 = 0.035f * p->speed;
+  // The flow color is the same everywhere apart from the darkening
+  int index = p->flowAmount;
+  int indexModulo = index % length;
+  uint32_t flowColor =
+      mix2(pallete[indexModulo], pallete[indexModulo + 1],
+           p->flowAmount - index, p->renderMode, 0.0f);
+  // Without the table, renderMode 1 is too branchy to do across lanes, so
+  // it's all left for the loop at the end
+  int vectorEnd = p->renderMode == 1 && !p->table ? start : end;
+  int i = start;
+  for (; i + LANES <= vectorEnd; i += LANES) {
+    vfloat t, l;
+    if (compact) {
+      vcount packedCounts;
+      vshade packedShades;
+      __builtin_memcpy(&packedCounts, p->counts + i, sizeof(packedCounts));
+      __builtin_memcpy(&packedShades, p->shades + i, sizeof(packedShades));
+      vuint counts = __builtin_convertvector(packedCounts, vuint);
+      vuint shades = __builtin_convertvector(packedShades, vuint);
+      vint inside = (vint)(counts == COMPACT_INTERIOR);
+      t = __builtin_convertvector(counts, vfloat) * unit;
+      t = (vfloat)(((vint)t & ~inside) |
+                   ((vint)((vfloat){0} - 999.0f) & inside));
+      l = (__builtin_convertvector(shades, vfloat) + 0.5f) * (1.0f / 200.0f);
     } else {
-      i = 2.0 * r * i + y;
-      r = sr - si + x;
+      __builtin_memcpy(&t, iters + i, sizeof(t));
+      __builtin_memcpy(&l, shade + i, sizeof(l));
     }
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      return result;
+    vint interior = t == -999.0f;
+    vint flow = t == 1.0f;
+    vint special = interior | flow;
+    // Keep the special values out of the palette math
+    t = (vfloat)(((vint)t & ~special) |
+                 ((vint)((vfloat){0} + 2.0f) & special));
+    vfloat darkenAmount = l;
+    if (p->darkenEffect == 2) {
+      darkenAmount = 1.0f - l;
+    }
+    vfloat position = vflog2(t) * speed1 + (t - 1) * speed2 + p->flowAmount;
+    vuint darkness = __builtin_convertvector(200 * darkenAmount, vuint);
+    // The same as getPallete(), with the division done in floats (and then
+    // nudged, as that can be one off)
+    vint whole = __builtin_convertvector(position, vint);
+    vint quotient = __builtin_convertvector(
+        __builtin_convertvector(whole, vfloat) * (1.0f / length), vint);
+    quotient += quotient * length > whole;
+    quotient -= (quotient + 1) * length <= whole;
+    vint id = whole - quotient * length;
+    vfloat mod = position -
+                 __builtin_convertvector(quotient * length, vfloat) -
+                 __builtin_convertvector(id, vfloat);
+    vuint color;
+    if (p->table) {
+      for (int k = 0; k < LANES; k++) {
+        color[k] = lookupSegment(p->table, id[k], mod[k]);
+      }
+      color = vmixBlack(color, darkness);
+    } else {
+      vuint from, to;
+      for (int k = 0; k < LANES; k++) {
+        from[k] = pallete[id[k]];
+        to[k] = pallete[id[k] + 1];
+      }
+      color = vmixBlack(
+          vmix(from, to, __builtin_convertvector(mod * 255, vuint)), darkness);
+    }
+    vuint flowColors = vmixBlack((vuint){0} + flowColor, darkness);
+    color = ((vuint)flow & flowColors) | (~(vuint)flow & color);
+    color = ((vuint)interior & p->interiorColor) | (~(vuint)interior & color);
+    __builtin_memcpy(p->colors + i, &color, sizeof(color));
+  }
+  for (; i < end; i++) {
+    if (compact) {
+      p->colors[i] =
+          colorPixel(p, countOf(p->counts[i], p->countFraction),
+                     shadeOf(p->shades[i]), speed1, speed2);
+    } else {
+      p->colors[i] = colorPixel(p, iters[i], shade[i], speed1, speed2);
     }
   }
-  return -999.0f;
 }
 
-float mbbs3S(int iterations, double x, double y, float *ptr) {
-  int exchange = 1;
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    if (exchange++ == 10) {
-      exchange = 1;
-      r = fabs(r) * (sr - 3.0 * si) + x;
-      i = fabs(i) * (3.0 * sr - si) + y;
-    } else {
-      r = r * (sr - 3.0 * si) + x;
-      i = i * (3.0 * sr - si) + y;
+static void recolorDefault(const RenderParams *p, int start, int end) {
+  if (p->counts) {
+    recolorLoop(p, start, end, 1);
+  } else {
+    recolorLoop(p, start, end, 0);
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static void recolorAvx2(const RenderParams *p,
+                                                        int start, int end) {
+  if (p->counts) {
+    recolorLoop(p, start, end, 1);
+  } else {
+    recolorLoop(p, start, end, 0);
+  }
+}
+
+__attribute__((target("avx512f"))) static void recolorAvx512(
+    const RenderParams *p, int start, int end) {
+  if (p->counts) {
+    recolorLoop(p, start, end, 1);
+  } else {
+    recolorLoop(p, start, end, 0);
+  }
+}
+#endif
+
+static RecolorKernel pickRecolorKernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return recolorAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return recolorAvx2;
+  }
+#endif
+  return recolorDefault;
+}
+
+static RecolorKernel recolorKernel;
+
+// Redo colors from iters after the palette, speed, flow, render mode or darken
+// effect changed. Every pixel in iters has to have been computed already.
+extern void recolor(int w, int h, float *iters, uint32_t *colors,
+                    uint32_t *pallete, int palleteLength,
+                    uint32_t interiorColor, int renderMode, int darkenEffect,
+                    float speed, float flowAmount) {
+  RenderParams p = {.w = w,
+                    .h = h,
+                    .iters = iters,
+                    .colors = colors,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount};
+  if (!recolorKernel) {
+    recolorKernel = pickRecolorKernel();
+  }
+  preparePalette(&p);
+  recolorKernel(&p, 0, w * h);
+}
+
+// recolor() for a frame in the compact field (see runCompact())
+extern void recolorCompact(int w, int h, uint16_t *counts, uint8_t *shades,
+                           uint32_t *colors, int iterations,
+                           uint32_t *pallete, int palleteLength,
+                           uint32_t interiorColor, int renderMode,
+                           int darkenEffect, float speed, float flowAmount) {
+  RenderParams p = {.w = w,
+                    .h = h,
+                    .colors = colors,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .counts = counts,
+                    .shades = shades,
+                    .countFraction = compactFraction(iterations)};
+  if (!recolorKernel) {
+    recolorKernel = pickRecolorKernel();
+  }
+  preparePalette(&p);
+  recolorKernel(&p, 0, w * h);
+}
+
+// -----
+
+// Anti-aliasing. Rendering at twice the size and scaling down costs four times
+// as much everywhere, but most of a frame is smooth bands that look the same
+// either way. runSupersampled() goes over a finished frame and only spends
+// extra samples on the pixels that need them: the ones on the boundary of the
+// set, or whose color is more than threshold (in any channel) away from one of
+// their neighbors'. Those get a samples x samples grid of jittered samples
+// across the pixel, and their color becomes the average of them.
+//
+// Only colors changes, so recolor() puts back the plain colors (it only
+// has one sample per pixel to go on). The jitter comes from a hash of where
+// the sample is, so the same frame always comes out the same. Every row of a
+// pixel's grid sits at the same y as that row of the other pixels in its row
+// of the frame, so the edge pixels of a row go through the lane kernels
+// together.
+
+#define SUPERSAMPLE_MAX LANES
+
+static inline int channelsDiffer(uint32_t a, uint32_t b, int threshold) {
+  int difference = (int)a - (int)b;
+  return difference > threshold || difference < -threshold;
+}
+
+static inline int colorsDiffer(uint32_t a, uint32_t b, int threshold) {
+  return channelsDiffer(getR(a), getR(b), threshold) ||
+         channelsDiffer(getG(a), getG(b), threshold) ||
+         channelsDiffer(getB(a), getB(b), threshold);
+}
+
+// Whether the pixels at index and other (with those colors) are different
+// enough to need smoothing out. Either can be uncomputed.
+static inline int pixelsDiffer(const float *iters, int index, uint32_t color,
+                               int other, uint32_t otherColor,
+                               int threshold) {
+  float t = iters[index];
+  float u = iters[other];
+  if (!t || !u) {
+    return 0;
+  }
+  return (t == -999.0f) != (u == -999.0f) ||
+         colorsDiffer(color, otherColor, threshold);
+}
+
+// A number in [0, 1) for sample k of row y of the frame (rows of the grids)
+// and, for the columns, pixel index
+static inline float jitter(uint32_t index, uint32_t k) {
+  uint32_t hash = index * (SUPERSAMPLE_MAX * 2) + k;
+  hash ^= hash >> 16;
+  hash *= 0x7feb352d;
+  hash ^= hash >> 15;
+  hash *= 0x846ca68b;
+  hash ^= hash >> 16;
+  return (hash >> 8) * (1.0f / (1 << 24));
+}
+
+// Replace the colors of the pixels (all in row y) with the average of
+// their grids. This adds what they cost to *score.
+static void supersamplePixels(const RenderParams *p, Kernels kernels,
+                              const int *pixels, int count, int y,
+                              int samples, float speed1, float speed2,
+                              int *score) {
+  int biggerIterations = p->iterations + 2;
+  int deep = kernels.precision == PRECISION_DOUBLE_DOUBLE;
+  float step = 1.0f / samples;
+  uint32_t sums[FLOAT_LANES][3] = {{0}};
+  for (int row = 0; row < samples; row++) {
+    double xs[FLOAT_LANES];
+    double xsLow[FLOAT_LANES];
+    double ys[FLOAT_LANES];
+    double ysLow[FLOAT_LANES];
+    float out[FLOAT_LANES];
+    float shade[FLOAT_LANES] = {0};
+    double offsetY = (y - 0.5 + (row + jitter(y, row)) * step) * p->zoom;
+    double coordinateY = p->posY + offsetY;
+    double yLow =
+        deep ? lowPart(p->posY, offsetY, coordinateY, p->posYLow) : 0;
+    for (int k = 0; k < count * samples; k++) {
+      int index = pixels[k / samples];
+      int column = k % samples;
+      float fraction = (column + jitter(index, samples * row + column)) * step;
+      double offset = (index % p->w - 0.5 + fraction) * p->zoom;
+      xs[k] = p->posX + offset;
+      xsLow[k] = deep ? lowPart(p->posX, offset, xs[k], p->posXLow) : 0;
+      ys[k] = coordinateY;
+      ysLow[k] = yLow;
     }
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.6309297535714575f;
-      return result;
+    kernels.lanes(p->iterations, &p->julia, xs, xsLow, ys, ysLow,
+                  count * samples, out, shade, NULL);
+    for (int k = 0; k < count * samples; k++) {
+      float n = settlePixel(out[k], biggerIterations, score);
+      uint32_t color = colorPixel(p, n, shade[k], speed1, speed2);
+      sums[k / samples][0] += getR(color);
+      sums[k / samples][1] += getG(color);
+      sums[k / samples][2] += getB(color);
     }
   }
-  return -999.0f;
+  uint32_t area = samples * samples;
+  for (int k = 0; k < count; k++) {
+    p->colors[pixels[k]] = toRGB((sums[k][0] + area / 2) / area,
+                                 (sums[k][1] + area / 2) / area,
+                                 (sums[k][2] + area / 2) / area);
+  }
 }
 
-float mbbs4S(int iterations, double x, double y, float *ptr) {
-  int exchange = 1;
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    if (exchange++ == 10) {
-      exchange = 1;
-      i = fabs(4.0 * r * i) * (sr - si) + y;
-      r = sr * sr - 6.0 * sr * si + si * si + x;
-    } else {
-      i = 4.0 * (sr * r * i - r * si * i) + y;
-      r = sr * (sr - 6.0 * si) + si * si + x;
+// Supersample the edge pixels of a finished frame, starting at the index
+// pixel. Returns where to resume from once *score goes over max, or -1 when
+// the frame is done.
+//
+// The pixels to the right and below haven't been touched yet, so they're
+// compared by what's in colors. The one to the left was compared with this one
+// the step before, and the one above may have been supersampled already, so
+// it's colored again from iters.
+static int renderSupersampled(const RenderParams *p, int pixel, int max,
+                              int samples, int threshold, int *score) {
+  int w = p->w;
+  int planeSize = w * p->h;
+  // (The score is checked after every batch, a lane group per row of samples)
+  max = capBudget(max,
+                  (long long)FLOAT_LANES * samples * (p->iterations + 13));
+  const float *iters = p->iters;
+  const float *shade = iters + planeSize;
+  const uint32_t *colors = p->colors;
+  float speed1 = sqrtf(sqrtf(p->speed));
+  float speed2 = 0.035f * p->speed;
+  Kernels kernels = pickKernels(p, 0, 0, w, p->h);
+  // As many pixels as fill the lanes with one row of their grids each
+  int batch = kernels.width / samples;
+  int pixels[FLOAT_LANES];
+  int count = 0;
+  int y = pixel / w;
+  int leftDiffers = 0;
+  if (pixel % w) {
+    leftDiffers = pixelsDiffer(
+        iters, pixel, colors[pixel], pixel - 1,
+        colorPixel(p, iters[pixel - 1], shade[pixel - 1], speed1, speed2),
+        threshold);
+  }
+  for (int i = pixel; i < planeSize; i++) {
+    int x = i - y * w;
+    uint32_t color = colors[i];
+    int rightDiffers = x + 1 < w && pixelsDiffer(iters, i, color, i + 1,
+                                                 colors[i + 1], threshold);
+    if (rightDiffers || leftDiffers ||
+        (i + w < planeSize &&
+         pixelsDiffer(iters, i, color, i + w, colors[i + w], threshold)) ||
+        (y > 0 && iters[i] && iters[i - w] &&
+         pixelsDiffer(iters, i, color, i - w,
+                      colorPixel(p, iters[i - w], shade[i - w], speed1,
+                                 speed2),
+                      threshold))) {
+      pixels[count++] = i;
     }
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si))) * 0.5f;
-      return result;
+    leftDiffers = rightDiffers;
+    // A batch ends when it's full, at the end of a row or at the end
+    if (count == batch || x + 1 == w) {
+      if (count) {
+        supersamplePixels(p, kernels, pixels, count, y, samples, speed1,
+                          speed2, score);
+        count = 0;
+      }
+      if (*score > max || cancelled(p)) {
+        return i + 1 < planeSize ? i + 1 : -1;
+      }
+      if (x + 1 == w) {
+        y++;
+        leftDiffers = 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Anti-alias a frame that run() (or any of the others) has finished, with the
+// same palette and so on. samples is how many samples a side the edge pixels
+// get (2 to 8), and threshold how far apart the colors of neighbors have to be
+// to count as an edge (0 to 255). pixel and max work like run()'s.
+extern int runSupersampled(int type, int w, int h, int pixel, double posX,
+                           double posY, double zoom, int max, float *iters,
+                           uint32_t *colors, int iterations,
+                           uint32_t *pallete, int palleteLength,
+                           uint32_t interiorColor, int renderMode,
+                           int darkenEffect, float speed, float flowAmount,
+                           int samples, int threshold) {
+  RenderParams p = {.type = type,
+                    .w = w,
+                    .h = h,
+                    .posX = posX,
+                    .posY = posY,
+                    .zoom = zoom,
+                    .iters = iters,
+                    .colors = colors,
+                    .iterations = iterations,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .posXLow = positionLowX,
+                    .posYLow = positionLowY,
+                    .forcedPrecision = forcedPrecision,
+                    .julia = juliaDefault,
+                    .generation = currentGeneration()};
+  samples = samples < 2 ? 2 : samples > SUPERSAMPLE_MAX ? SUPERSAMPLE_MAX
+                                                        : samples;
+  int score = 0;
+  preparePalette(&p);
+  return renderSupersampled(&p, pixel, max, samples, threshold, &score);
+}
+
+// -----
+
+// Arbitrary points. runPoints() iterates count points that aren't on a grid,
+// (centerX + dx[k], centerY + dy[k]), such as a ring of the log-polar strip a
+// zoom video is made from. iters works like a frame's with w = count and h = 1
+// (the smoothed counts, then the shading), so recolor() can color it. spacing
+// is about how far apart neighboring points are, which picks the precision
+// like a frame's zoom does, and setPositionLow() applies to the center.
+extern void runPoints(int type, int count, double centerX, double centerY,
+                      const double *dx, const double *dy, double spacing,
+                      float *iters, int iterations, int darkenEffect) {
+  double largest = 0;
+  for (int k = 0; k < count; k++) {
+    double x = fabs(centerX + dx[k]);
+    double y = fabs(centerY + dy[k]);
+    largest = x > largest ? x : largest;
+    largest = y > largest ? y : largest;
+  }
+  // (Taken once, like a frame's RenderParams)
+  JuliaSet julia = juliaDefault;
+  double lowX = positionLowX;
+  double lowY = positionLowY;
+  Kernels kernels = kernelsFor(
+      precisionFor(spacing, largest, forcedPrecision, type, darkenEffect),
+      type, shadingOf(darkenEffect));
+  int deep = kernels.precision == PRECISION_DOUBLE_DOUBLE;
+  for (int start = 0; start < count; start += kernels.width) {
+    int batch = count - start < kernels.width ? count - start : kernels.width;
+    double xs[FLOAT_LANES];
+    double xsLow[FLOAT_LANES];
+    double ys[FLOAT_LANES];
+    double ysLow[FLOAT_LANES];
+    for (int k = 0; k < batch; k++) {
+      xs[k] = centerX + dx[start + k];
+      ys[k] = centerY + dy[start + k];
+      xsLow[k] = deep ? lowPart(centerX, dx[start + k], xs[k], lowX) : 0;
+      ysLow[k] = deep ? lowPart(centerY, dy[start + k], ys[k], lowY) : 0;
+      iters[count + start + k] = 0;
+    }
+    kernels.lanes(iterations, &julia, xs, xsLow, ys, ysLow, batch,
+                  iters + start, iters + count + start, NULL);
+    // (Nothing is charged for points, so the score is thrown away)
+    int score = 0;
+    for (int k = start; k < start + batch; k++) {
+      iters[k] = settlePixel(iters[k], iterations + 2, &score);
     }
   }
-  return -999.0f;
 }
 
 // -----
 
-float mandS2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = 2 * r * i + y;
-    r = sr - si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
-    }
-  }
-  return -999.0f;
+// Deep zooms. Doubles run out of precision around a zoom of 1e-14, so instead
+// of iterating every pixel from its own coordinates this computes one
+// reference orbit Z at the center of the frame in high precision, and every
+// pixel only iterates its (tiny) difference from it in doubles:
+//   (Z + d)^p + C + dc - (Z^p + C) = sum of binomial(p, j) Z^(p - j) d^j + dc
+// A series approximation (d is roughly A dc + B dc^2 + C dc^3 for the first
+// few hundred iterations) lets every pixel skip straight past the start of
+// the orbit. Whenever a pixel gets closer to zero than it is to the reference
+// (|Z + d| < |d|, which is exactly when perturbation starts to glitch), or the
+// reference runs out because it escaped, the pixel rebases: d becomes Z + d and
+// it carries on from the start of the reference orbit. Only the powers of z
+// (mand to mand7) are supported.
+
+// Up to 736 bits of fraction, which is plenty for zooms of 1e-200
+#define DEEP_MAX_LIMBS 25
+
+// A signed fixed-point number in two's complement. The lowest limbs are the
+// fraction and the top two limbs are the integer part (mand7 needs more than
+// 32 bits there before the reference escapes).
+typedef struct {
+  uint32_t limb[DEEP_MAX_LIMBS];
+} BigFixed;
+
+static inline int bigNegative(const BigFixed *a, int limbs) {
+  return a->limb[limbs - 1] >> 31;
 }
 
-float mand3S2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    r = r * (sr - 3.0 * si) + x;
-    i = i * (3.0 * sr - si) + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.6309297535714575f;
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
-    }
+static void bigNegate(BigFixed *a, int limbs) {
+  uint64_t carry = 1;
+  for (int k = 0; k < limbs; k++) {
+    carry += (uint32_t)~a->limb[k];
+    a->limb[k] = (uint32_t)carry;
+    carry >>= 32;
   }
-  return -999.0f;
 }
 
-float mand4S2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = 4.0 * (sr * r * i - r * si * i) + y;
-    r = sr * (sr - 6.0 * si) + si * si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si))) * 0.5f;
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
-    }
+static void bigAdd(BigFixed *out, const BigFixed *a, const BigFixed *b,
+                   int limbs) {
+  uint64_t carry = 0;
+  for (int k = 0; k < limbs; k++) {
+    carry += (uint64_t)a->limb[k] + b->limb[k];
+    out->limb[k] = (uint32_t)carry;
+    carry >>= 32;
   }
-  return -999.0f;
 }
 
-float mand5S2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double fi = si * si;
-  for (int n = 1; n <= iterations; n++) {
-    i = i * (sr * (5.0 * sr - 10.0 * si) + fi) + y;
-    r = r * (sr * (sr - 10.0 * si) + 5.0 * fi) + x;
-    sr = r * r;
-    si = i * i;
-    fi = si * si;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.43067655807339306f;
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+static void bigSub(BigFixed *out, const BigFixed *a, const BigFixed *b,
+                   int limbs) {
+  BigFixed negative = *b;
+  bigNegate(&negative, limbs);
+  bigAdd(out, a, &negative, limbs);
+}
+
+static void bigMul(BigFixed *out, const BigFixed *a, const BigFixed *b,
+                   int limbs) {
+  int fraction = limbs - 2;
+  BigFixed x = *a;
+  BigFixed y = *b;
+  int negative = bigNegative(&x, limbs) ^ bigNegative(&y, limbs);
+  if (bigNegative(&x, limbs)) {
+    bigNegate(&x, limbs);
+  }
+  if (bigNegative(&y, limbs)) {
+    bigNegate(&y, limbs);
+  }
+  uint32_t product[2 * DEEP_MAX_LIMBS] = {0};
+  for (int i = 0; i < limbs; i++) {
+    uint64_t carry = 0;
+    uint64_t xi = x.limb[i];
+    // Limbs of the product below fraction - 1 never reach the result
+    int j = fraction - 1 - i > 0 ? fraction - 1 - i : 0;
+    for (; j < limbs; j++) {
+      carry += xi * y.limb[j] + product[i + j];
+      product[i + j] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    for (int k = i + limbs; carry && k < 2 * limbs; k++) {
+      carry += product[k];
+      product[k] = (uint32_t)carry;
+      carry >>= 32;
     }
   }
-  return -999.0f;
+  for (int k = 0; k < limbs; k++) {
+    out->limb[k] = product[k + fraction];
+  }
+  if (negative) {
+    bigNegate(out, limbs);
+  }
 }
 
-float mand6S2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double fr = sr * sr;
-  double fi = si * si;
-  for (int n = 1; n <= iterations; n++) {
-    i = r * i * (6.0 * (fr + fi) - 20.0 * sr * si) + y;
-    r = sr * (fr + 15.0 * fi) - si * (15.0 * fr + fi) + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.38685280723454163f;
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
-    }
-    fr = sr * sr;
-    fi = si * si;
+static double bigToDouble(const BigFixed *a, int limbs) {
+  BigFixed x = *a;
+  int negative = bigNegative(&x, limbs);
+  if (negative) {
+    bigNegate(&x, limbs);
   }
-  return -999.0f;
+  // Only the top few limbs matter, but this avoids needing ldexp() in WASM
+  double scale = 4294967296.0;
+  double result = 0;
+  for (int k = limbs - 1; k >= 0 && scale; k--) {
+    result += x.limb[k] * scale;
+    scale *= 2.3283064365386963e-10;
+  }
+  return negative ? -result : result;
 }
 
-float mand7S2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double fr = sr * sr;
-  double fi = si * si;
-  for (int n = 1; n <= iterations; n++) {
-    r = r * (fr * (sr - 21.0 * si) + fi * (35.0 * sr - 7.0 * si)) + x;
-    i = i * (fr * (7.0 * sr - 35.0 * si) + fi * (21.0 * sr - si)) + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.3562071871080222f;
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+// Parse a plain decimal number like "-0.7436438870371587047521915061" (no
+// exponents). Returns 0 if the string isn't one.
+static int bigFromString(BigFixed *out, const char *text, int limbs) {
+  int fraction = limbs - 2;
+  int negative = 0;
+  for (int k = 0; k < limbs; k++) {
+    out->limb[k] = 0;
+  }
+  if (*text == '-' || *text == '+') {
+    negative = *text++ == '-';
+  }
+  uint64_t whole = 0;
+  int digits = 0;
+  for (; *text >= '0' && *text <= '9'; text++, digits++) {
+    whole = whole * 10 + (*text - '0');
+  }
+  if (*text == '.') {
+    const char *start = ++text;
+    while (*text >= '0' && *text <= '9') {
+      text++;
+    }
+    digits += text - start;
+    // Work from the last digit back: fraction = (fraction + digit) / 10
+    for (const char *digit = text - 1; digit >= start; digit--) {
+      out->limb[fraction] += *digit - '0';
+      uint64_t remainder = 0;
+      for (int k = fraction; k >= 0; k--) {
+        uint64_t value = (remainder << 32) | out->limb[k];
+        out->limb[k] = (uint32_t)(value / 10);
+        remainder = value % 10;
+      }
     }
-    fr = sr * sr;
-    fi = si * si;
   }
-  return -999.0f;
+  if (*text || !digits) {
+    return 0;
+  }
+  out->limb[fraction] = (uint32_t)whole;
+  out->limb[fraction + 1] = (uint32_t)(whole >> 32);
+  if (negative) {
+    bigNegate(out, limbs);
+  }
+  return 1;
 }
 
-float shipS2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  double dr = 1;
-  double di = 0;
-  for (int n = 1; n <= iterations; n++) {
-    i = fabs(2.0 * r * i) + y;
-    r = sr - si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
-    }
+// How many limbs a zoom needs: the 64 bits that matter below the pixel size,
+// plus the integer part
+static int deepLimbs(double zoom) {
+  int limbs = 4;
+  for (double size = 1.0; size > zoom && limbs < DEEP_MAX_LIMBS; limbs++) {
+    size *= 2.3283064365386963e-10;
   }
-  return -999.0f;
+  return limbs;
 }
 
-float ship3S2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    r = fabs(r) * (sr - 3.0 * si) + x;
-    i = fabs(i) * (3.0 * sr - si) + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.6309297535714575f;
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+static const double binomials[8][8] = {
+    {1},
+    {1, 1},
+    {1, 2, 1},
+    {1, 3, 3, 1},
+    {1, 4, 6, 4, 1},
+    {1, 5, 10, 10, 5, 1},
+    {1, 6, 15, 20, 15, 6, 1},
+    {1, 7, 21, 35, 35, 21, 7, 1}};
+
+// The orbit buffer starts with a small header; the reference orbit itself
+// (Z_0 = 0, Z_1 = C, ...) follows as pairs of doubles.
+#define DEEP_HEADER 8
+
+// Compute the reference orbit of the point (centerX, centerY) into orbit and
+// the series approximation for a frame whose pixels are at most maxDelta away
+// from it. Returns 0 if the coordinates couldn't be parsed.
+static int computeReference(int type, int iterations, const char *centerX,
+                            const char *centerY, double zoom, double maxDelta,
+                            double *orbit) {
+  int degree = type + 2;
+  int limbs = deepLimbs(zoom);
+  BigFixed cr, ci;
+  if (!bigFromString(&cr, centerX, limbs) ||
+      !bigFromString(&ci, centerY, limbs)) {
+    return 0;
+  }
+  BigFixed zr = {{0}};
+  BigFixed zi = {{0}};
+  double *z = orbit + DEEP_HEADER;
+  int length = 0;
+  z[0] = 0;
+  z[1] = 0;
+  while (length <= iterations) {
+    // Z = Z^degree + C
+    BigFixed pr = zr;
+    BigFixed pi = zi;
+    for (int k = 1; k < degree; k++) {
+      BigFixed a, b, c, d;
+      bigMul(&a, &pr, &zr, limbs);
+      bigMul(&b, &pi, &zi, limbs);
+      bigMul(&c, &pr, &zi, limbs);
+      bigMul(&d, &pi, &zr, limbs);
+      bigSub(&pr, &a, &b, limbs);
+      bigAdd(&pi, &c, &d, limbs);
+    }
+    bigAdd(&zr, &pr, &cr, limbs);
+    bigAdd(&zi, &pi, &ci, limbs);
+    length++;
+    double r = bigToDouble(&zr, limbs);
+    double i = bigToDouble(&zi, limbs);
+    z[2 * length] = r;
+    z[2 * length + 1] = i;
+    if (r * r + i * i > 2500.0) {
+      break;
     }
   }
-  return -999.0f;
-}
 
-float ship4S2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = fabs(4.0 * r * i) * (sr - si) + y;
-    r = sr * sr - 6.0 * sr * si + si * si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si))) * 0.5f;
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+  // Series approximation: d_n = A_n dc + B_n dc^2 + C_n dc^3, starting from
+  // d_1 = dc. Stop once the cubic term (and so everything the series leaves
+  // out) stops being negligible next to the linear one at the frame corners.
+  double ar = 1, ai = 0, br = 0, bi = 0, qr = 0, qi = 0;
+  int skip = 1;
+  for (int n = 1; n < length - 1; n++) {
+    double r = z[2 * n];
+    double i = z[2 * n + 1];
+    // Powers of Z up to degree - 1
+    double powr[8] = {1};
+    double powi[8] = {0};
+    for (int k = 1; k < degree; k++) {
+      powr[k] = powr[k - 1] * r - powi[k - 1] * i;
+      powi[k] = powr[k - 1] * i + powi[k - 1] * r;
     }
+    // f' / 1!, f'' / 2! and f''' / 3! at Z
+    double f1r = degree * powr[degree - 1], f1i = degree * powi[degree - 1];
+    double f2r = binomials[degree][2] * powr[degree - 2];
+    double f2i = binomials[degree][2] * powi[degree - 2];
+    double f3r = degree > 2 ? binomials[degree][3] * powr[degree - 3] : 0;
+    double f3i = degree > 2 ? binomials[degree][3] * powi[degree - 3] : 0;
+    double aar = ar * ar - ai * ai, aai = 2 * ar * ai;
+    double abr = ar * br - ai * bi, abi = ar * bi + ai * br;
+    double aaar = aar * ar - aai * ai, aaai = aar * ai + aai * ar;
+    double nar = f1r * ar - f1i * ai + 1;
+    double nai = f1r * ai + f1i * ar;
+    double nbr = f1r * br - f1i * bi + f2r * aar - f2i * aai;
+    double nbi = f1r * bi + f1i * br + f2r * aai + f2i * aar;
+    double nqr = f1r * qr - f1i * qi + 2 * (f2r * abr - f2i * abi) +
+                 f3r * aaar - f3i * aaai;
+    double nqi = f1r * qi + f1i * qr + 2 * (f2r * abi + f2i * abr) +
+                 f3r * aaai + f3i * aaar;
+    double sizeA = sqrt(nar * nar + nai * nai) * maxDelta;
+    double sizeC = sqrt(nqr * nqr + nqi * nqi) * maxDelta * maxDelta * maxDelta;
+    // (written so that infinities and NaNs also stop it)
+    if (!(sizeC <= sizeA * 1e-8)) {
+      break;
+    }
+    ar = nar, ai = nai, br = nbr, bi = nbi, qr = nqr, qi = nqi;
+    skip = n + 1;
   }
-  return -999.0f;
+  orbit[0] = length;
+  orbit[1] = skip;
+  orbit[2] = ar;
+  orbit[3] = ai;
+  orbit[4] = br;
+  orbit[5] = bi;
+  orbit[6] = qr;
+  orbit[7] = qi;
+  return 1;
 }
 
-float celtS2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = 2.0 * r * i + y;
-    r = fabs(sr - si) + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
+// Iterate one pixel that is (dcr, dci) away from the reference, with the same
+// results (and shading) as the matching function above
+static float iterateDeep(const double *orbit, int type, int darkenEffect,
+                         int iterations, double dcr, double dci, float *ptr,
+                         int *steps) {
+  int degree = type + 2;
+  int length = orbit[0];
+  int skip = orbit[1];
+  const double *z = orbit + DEEP_HEADER;
+  int derivative = (darkenEffect == 1 || darkenEffect == 2) && type <= 3;
+  double bailout = type == 0 && darkenEffect == 0 ? 500.0 : 2500.0;
+
+  // Jump ahead with the series approximation
+  double dc2r = dcr * dcr - dci * dci, dc2i = 2 * dcr * dci;
+  double dc3r = dc2r * dcr - dc2i * dci, dc3i = dc2r * dci + dc2i * dcr;
+  double ar = orbit[2], ai = orbit[3], br = orbit[4], bi = orbit[5];
+  double qr = orbit[6], qi = orbit[7];
+  double dr = ar * dcr - ai * dci + br * dc2r - bi * dc2i + qr * dc3r -
+              qi * dc3i;
+  double di = ar * dci + ai * dcr + br * dc2i + bi * dc2r + qr * dc3i +
+              qi * dc3r;
+  // dz/dc of the series
+  double derr = ar + 2 * (br * dcr - bi * dci) + 3 * (qr * dc2r - qi * dc2i);
+  double deri = ai + 2 * (br * dci + bi * dcr) + 3 * (qr * dc2i + qi * dc2r);
+  int ref = skip;
+
+  for (int n = skip; n <= iterations; n++) {
+    double zr = z[2 * ref];
+    double zi = z[2 * ref + 1];
+    if (derivative) {
+      // dz = degree * z^(degree - 1) * dz + 1, with the full z
+      double r = zr + dr, i = zi + di;
+      double pr = degree, pi = 0;
+      for (int k = 1; k < degree; k++) {
+        double t = pr * r - pi * i;
+        pi = pr * i + pi * r;
+        pr = t;
+      }
+      double t = pr * derr - pi * deri + 1.0;
+      deri = pr * deri + pi * derr;
+      derr = t;
+      // Only the direction matters in the end, so keep it from overflowing
+      if (fabs(derr) + fabs(deri) > 1e150) {
+        derr *= 1e-150;
+        deri *= 1e-150;
+      }
+    }
+    // d = ((Z + d)^degree - Z^degree) + dc, using Horner's method in d
+    if (degree == 2) {
+      double t = (2 * zr + dr) * dr - (2 * zi + di) * di + dcr;
+      di = (2 * zr + dr) * di + (2 * zi + di) * dr + dci;
+      dr = t;
+    } else {
+      double powr[8] = {1};
+      double powi[8] = {0};
+      for (int k = 1; k < degree; k++) {
+        powr[k] = powr[k - 1] * zr - powi[k - 1] * zi;
+        powi[k] = powr[k - 1] * zi + powi[k - 1] * zr;
+      }
+      double hr = 1, hi = 0;
+      for (int j = degree - 1; j >= 1; j--) {
+        double t = hr * dr - hi * di + binomials[degree][j] * powr[degree - j];
+        hi = hr * di + hi * dr + binomials[degree][j] * powi[degree - j];
+        hr = t;
+      }
+      double t = hr * dr - hi * di + dcr;
+      di = hr * di + hi * dr + dci;
+      dr = t;
+    }
+    ref++;
+    double r = z[2 * ref] + dr;
+    double i = z[2 * ref + 1] + di;
+    double sr = r * r;
+    double si = i * i;
+    if (sr + si > bailout) {
+      float result = (float)n - (secondLog(sqrtf(sr + si))) * smoothing[type];
+      if (derivative) {
+        double sqm = derr * derr + deri * deri;
+        double ur = (r * derr + i * deri) / sqm;
+        double ui = (i * derr - r * deri) / sqm;
+        double norm = sqrt(ur * ur + ui * ui);
+        ur /= norm;
+        ui /= norm;
+        float t = (ur + ui) * 0.7071067811865475f + 1.5f;
+        *ptr = t <= 0 ? 0 : (t * 0.4f);
+      } else if (darkenEffect == 3) {
+        double ur = r + i;
+        double ui = i - r;
+        double norm = sqrt(ur * ur + ui * ui);
+        ur /= norm;
+        ui /= norm;
+        float t = (ur + ui) * 0.7071067811865475f + 1.5f;
+        *ptr = t <= 0 ? 0 : t * 0.4f;
+      }
+      *steps = n;
       return result;
     }
+    // Rebase onto the start of the reference orbit
+    if (sr + si < dr * dr + di * di || ref == length) {
+      dr = r;
+      di = i;
+      ref = 0;
+    }
   }
+  *steps = iterations;
   return -999.0f;
 }
 
-float prmbS2(int iterations, double x, double y, float *ptr) {
-  double r = fabs(x);
-  double i = -y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    double tr = 2.0 * r * i;
-    r = fabs(sr - i * i + x);
-    i = -tr - y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+// Like run(), but for zooms far past what doubles can do. The center of the
+// frame is given as decimal strings (as many digits as the zoom needs) and zoom
+// is still the size of a pixel. orbit is scratch space for the reference orbit
+// that must hold 2 * iterations + 12 doubles; it is computed when pixel is 0
+// and reused when a frame is resumed. Formulas other than mand to mand7, and
+// Julia sets, fall back to run() at double precision.
+extern int runDeep(int type, int w, int h, int pixel, const char *centerX,
+                   const char *centerY, double zoom, int max, float *iters,
+                   uint32_t *colors, int iterations, uint32_t *pallete,
+                   int palleteLength, uint32_t interiorColor, int renderMode,
+                   int darkenEffect, float speed, float flowAmount,
+                   double *orbit) {
+  double halfW = w * 0.5;
+  double halfH = h * 0.5;
+  if (type > 5 || juliaDefault.on) {
+    BigFixed x, y;
+    int limbs = deepLimbs(1.0);
+    bigFromString(&x, centerX, limbs);
+    bigFromString(&y, centerY, limbs);
+    return run(type, w, h, pixel, bigToDouble(&x, limbs) - halfW * zoom,
+               bigToDouble(&y, limbs) - halfH * zoom, zoom, max, iters, colors,
+               iterations, pallete, palleteLength, interiorColor, renderMode,
+               darkenEffect, speed, flowAmount);
+  }
+  if (pixel == 0 &&
+      !computeReference(type, iterations, centerX, centerY, zoom,
+                        sqrt(halfW * halfW + halfH * halfH) * zoom, orbit)) {
+    return -1;
+  }
+  RenderParams p = {.type = type,
+                    .w = w,
+                    .h = h,
+                    .zoom = zoom,
+                    .iters = iters,
+                    .colors = colors,
+                    .iterations = iterations,
+                    .pallete = pallete,
+                    .palleteLength = palleteLength,
+                    .interiorColor = interiorColor,
+                    .renderMode = renderMode,
+                    .darkenEffect = darkenEffect,
+                    .speed = speed,
+                    .flowAmount = flowAmount,
+                    .stats = renderStats,
+                    .generation = currentGeneration()};
+  int limit = w * h;
+  int score = 0;
+  max = capBudget(max, iterations + 13);
+  preparePalette(&p);
+  int biggerIterations = iterations + 2;
+  float speed1 = sqrtf(sqrtf(speed));
+  float speed2 = 0.035f * speed;
+  RenderStats counts;
+  RenderStats *tally = NULL;
+  long long started = 0;
+  if (p.stats) {
+    counts = (RenderStats){0};
+    tally = &counts;
+    started = statsClock();
+  }
+  int result = -1;
+  for (int i = pixel; i < limit; i++) {
+    float *ptr = iters + limit + i;
+    float n = iters[i];
+    if (!n) {
+      int steps;
+      long long clock = tally ? statsClock() : 0;
+      n = iterateDeep(orbit, type, darkenEffect, iterations,
+                      (i % w - halfW) * zoom, (i / w - halfH) * zoom, ptr,
+                      &steps);
+      if (tally) {
+        tally->formulaNanoseconds += statsClock() - clock;
+        tallyPixel(tally, p.stats->cost, i, n, steps, iterations);
+      }
+      n = settlePixel(n, biggerIterations, &score);
+      iters[i] = n;
+    }
+    colors[i] = colorPixel(&p, n, *ptr, speed1, speed2);
+    if (score > max || cancelled(&p)) {
+      result = i;
+      break;
     }
   }
-  return -999.0f;
+  if (tally) {
+    finishTally(&p, tally, score, started);
+  }
+  return result;
 }
 
-float buffS2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    r = fabs(r);
-    i = fabs(i);
-    double tr = 2.0 * r * i;
-    r = sr - si - r + x;
-    i = tr - i + y;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+#ifndef __wasm__
+// -----
+
+// Native only: a small thread pool that runs numbered tasks with work stealing.
+// Each worker starts with a contiguous range of task numbers and takes tasks
+// from the front of it; a worker that runs dry steals the back half of another
+// worker's range. A range is packed into one 64-bit word (next task in the low
+// half, end in the high half), so both taking and stealing are a single
+// compare-and-swap.
+
+// Return nonzero from a task to stop handing out the remaining ones
+typedef int (*PoolTask)(void *context, int task, int worker);
+
+typedef struct {
+  _Atomic uint64_t range;
+  // Keep every queue on its own cache line
+  char padding[64 - sizeof(uint64_t)];
+} WorkQueue;
+
+typedef struct TilePool {
+  int threads;
+  pthread_t *handles;
+  WorkQueue *queues;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t finished;
+  int generation;
+  int busy;
+  int quit;
+  atomic_int stop;
+  PoolTask task;
+  void *context;
+} TilePool;
+
+static inline uint64_t packRange(uint32_t next, uint32_t end) {
+  return ((uint64_t)end << 32) | next;
+}
+
+static int takeTask(WorkQueue *queue) {
+  uint64_t range = atomic_load(&queue->range);
+  for (;;) {
+    uint32_t next = (uint32_t)range;
+    uint32_t end = range >> 32;
+    if (next >= end) {
+      return -1;
+    }
+    if (atomic_compare_exchange_weak(&queue->range, &range,
+                                     packRange(next + 1, end))) {
+      return next;
     }
   }
-  return -999.0f;
 }
 
-float tricS2(int iterations, double x, double y, float *ptr) {
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    i = -2.0 * r * i + y;
-    r = sr - si + x;
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+// Move the back half of some other worker's range into our own queue and
+// return its first task (or -1 once every queue is empty)
+static int stealTask(TilePool *pool, int worker) {
+  for (int k = 1; k < pool->threads; k++) {
+    WorkQueue *victim = &pool->queues[(worker + k) % pool->threads];
+    uint64_t range = atomic_load(&victim->range);
+    for (;;) {
+      uint32_t next = (uint32_t)range;
+      uint32_t end = range >> 32;
+      if (next >= end) {
+        break;
+      }
+      uint32_t middle = next + (end - next) / 2;
+      if (atomic_compare_exchange_weak(&victim->range, &range,
+                                       packRange(next, middle))) {
+        atomic_store(&pool->queues[worker].range, packRange(middle + 1, end));
+        return middle;
+      }
     }
   }
-  return -999.0f;
+  return -1;
 }
 
-float mbbsS2(int iterations, double x, double y, float *ptr) {
-  int exchange = 1;
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    if (exchange++ == 10) {
-      exchange = 1;
-      i = fabs(2.0 * r * i) + y;
-      r = sr - si + x;
-    } else {
-      i = 2.0 * r * i + y;
-      r = sr - si + x;
+static void workTasks(TilePool *pool, int worker) {
+  while (!atomic_load(&pool->stop)) {
+    int task = takeTask(&pool->queues[worker]);
+    if (task < 0) {
+      task = stealTask(pool, worker);
+      if (task < 0) {
+        return;
+      }
     }
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si)));
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+    if (pool->task(pool->context, task, worker)) {
+      atomic_store(&pool->stop, 1);
     }
   }
-  return -999.0f;
 }
 
-float mbbs3S2(int iterations, double x, double y, float *ptr) {
-  int exchange = 1;
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    if (exchange++ == 10) {
-      exchange = 1;
-      r = fabs(r) * (sr - 3.0 * si) + x;
-      i = fabs(i) * (3.0 * sr - si) + y;
-    } else {
-      r = r * (sr - 3.0 * si) + x;
-      i = i * (3.0 * sr - si) + y;
+typedef struct {
+  TilePool *pool;
+  int worker;
+} PoolWorker;
+
+static void *poolThread(void *argument) {
+  PoolWorker worker = *(PoolWorker *)argument;
+  free(argument);
+  TilePool *pool = worker.pool;
+  int generation = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->generation == generation && !pool->quit) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
     }
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result =
-          (float)n - (secondLog(sqrtf(sr + si))) * 0.6309297535714575f;
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+    if (pool->quit) {
+      break;
+    }
+    generation = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+    workTasks(pool, worker.worker);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0) {
+      pthread_cond_signal(&pool->finished);
     }
   }
-  return -999.0f;
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
 }
 
-float mbbs4S2(int iterations, double x, double y, float *ptr) {
-  int exchange = 1;
-  double r = x;
-  double i = y;
-  double sr = r * r;
-  double si = i * i;
-  for (int n = 1; n <= iterations; n++) {
-    if (exchange++ == 10) {
-      exchange = 1;
-      i = fabs(4.0 * r * i) * (sr - si) + y;
-      r = sr * sr - 6.0 * sr * si + si * si + x;
-    } else {
-      i = 4.0 * (sr * r * i - r * si * i) + y;
-      r = sr * (sr - 6.0 * si) + si * si + x;
+// The calling thread is worker 0, so a pool of n threads starts n - 1 of its
+// own. Returns NULL if the threads can't be created.
+extern TilePool *createTilePool(int threads) {
+  TilePool *pool = calloc(1, sizeof(TilePool));
+  if (!pool) {
+    return NULL;
+  }
+  pool->threads = threads < 1 ? 1 : threads;
+  pool->handles = calloc(pool->threads, sizeof(pthread_t));
+  pool->queues = aligned_alloc(64, pool->threads * sizeof(WorkQueue));
+  if (!pool->handles || !pool->queues) {
+    free(pool->handles);
+    free(pool->queues);
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->finished, NULL);
+  if (!laneKernels) {
+    laneKernels = pickLaneKernels();
+  }
+  if (!recolorKernel) {
+    recolorKernel = pickRecolorKernel();
+  }
+  for (int k = 1; k < pool->threads; k++) {
+    PoolWorker *worker = malloc(sizeof(PoolWorker));
+    if (worker) {
+      worker->pool = pool;
+      worker->worker = k;
     }
-    sr = r * r;
-    si = i * i;
-    if (sr + si > 2500.0) {
-      float result = (float)n - (secondLog(sqrtf(sr + si))) * 0.5f;
-      double ur = r + i;
-      double ui = i - r;
-      double norm = sqrt(ur * ur + ui * ui);
-      ur /= norm;
-      ui /= norm;
-      float t = (ur + ui) * 0.7071067811865475f + 1.5f;
-      *ptr = t <= 0 ? 0 : t * 0.4f;
-      return result;
+    if (!worker ||
+        pthread_create(&pool->handles[k], NULL, poolThread, worker)) {
+      free(worker);
+      // Run with the threads we did get
+      pool->threads = k;
+      break;
     }
   }
-  return -999.0f;
+  return pool;
 }
 
-extern int run(int type, int w, int h, int pixel, double posX, double posY,
-               double zoom, int max, float *iters, uint32_t *colors,
-               int iterations, uint32_t *pallete, int palleteLength,
-               uint32_t interiorColor, int renderMode, int darkenEffect,
-               float speed, float flowAmount) {
-  // The boring stuff is here! We use 32-bit RGBA uint32_t instead of 8-bit
-  // numbers for the coloring, because it's simpler and doesn't slow down JS at
-  // all (we can access it with Uint8ClampedArray)
-  int i = pixel;
-  double x = i % w;
-  double y = i / w;
-  int W = w;
-  int score = 0;
-  int limit = w * h;
-  int biggerIterations = iterations + 2;
+extern void destroyTilePool(TilePool *pool) {
+  if (!pool) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for (int k = 1; k < pool->threads; k++) {
+    pthread_join(pool->handles[k], NULL);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wake);
+  pthread_cond_destroy(&pool->finished);
+  free(pool->handles);
+  free(pool->queues);
+  free(pool);
+}
 
-  // Pre-calculate speed constants for faster renderings
-  float speed1 = sqrtf(sqrtf(speed));
-  float speed2 = 0.035f * speed;
-  float *itersPtr = iters;
+// Run tasks 0 to count - 1 on every worker and wait for them. Returns 1 if a
+// task asked to stop early (so some tasks may not have run) and 0 otherwise.
+static int runPoolTasks(TilePool *pool, int count, PoolTask task,
+                        void *context) {
+  pool->task = task;
+  pool->context = context;
+  atomic_store(&pool->stop, 0);
+  for (int k = 0; k < pool->threads; k++) {
+    atomic_store(&pool->queues[k].range,
+                 packRange((int64_t)count * k / pool->threads,
+                           (int64_t)count * (k + 1) / pool->threads));
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->busy = pool->threads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
 
-  // This uses a do...while rather than a simple while, so it doesn't increment
-  // the first time.
+  workTasks(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy) {
+    pthread_cond_wait(&pool->finished, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return atomic_load(&pool->stop);
+}
+
+// How much of the budget a tile gets at a time. Its score is counted per slice,
+// so it can't overflow however many iterations there are, and a tile notices
+// between slices when the budget has run out or the render was cancelled.
+#define TILE_SLICE (1 << 24)
+
+typedef struct {
+  const RenderParams *params;
+  int tileSize;
+  int tilesX;
+  int max;
+  atomic_llong spent;
+  atomic_int finished;
+  unsigned char *done;
+} TileJob;
+
+static int renderTileTask(void *context, int task, int worker) {
+  TileJob *job = context;
+  (void)worker;
+  if (job->done && job->done[task]) {
+    atomic_fetch_add(&job->finished, 1);
+    return 0;
+  }
+  // Every worker draws from the same budget; once it's spent, the tiles that
+  // haven't been started are left for the next call
+  if (atomic_load(&job->spent) > job->max || cancelled(job->params)) {
+    return 1;
+  }
+  const RenderParams *p = job->params;
+  int x0 = task % job->tilesX * job->tileSize;
+  int y0 = task / job->tilesX * job->tileSize;
+  int x1 = x0 + job->tileSize < p->w ? x0 + job->tileSize : p->w;
+  int y1 = y0 + job->tileSize < p->h ? y0 + job->tileSize : p->h;
+  int pixel = 0;
   do {
-    if (x == W) {
-      x = 0;
-      y++;
-    }
-    float t = iters[i];
-    float *ptr = itersPtr + limit + i;
-    if (t) {
-      if (t == -999.0f) {
-        colors[i] = interiorColor;
-      } else if (t == 1.0f) {
-        int index = flowAmount;
-        int indexModulo = index % palleteLength;
-        float l = *ptr;
-        colors[i] = mix2(pallete[indexModulo], pallete[indexModulo + 1],
-                         flowAmount - index, renderMode,
-                         darkenEffect == 2 ? 1.0f - l : l);
-      } else {
-        float l = *ptr;
-        colors[i] = getPallete(
-            flog2(t) * speed1 + (t - 1) * speed2 + flowAmount, pallete,
-            palleteLength, renderMode, darkenEffect == 2 ? 1.0f - l : l);
-      }
-      x++;
-      continue;
+    int score = 0;
+    pixel = renderRect(p, x0, y0, x1, y1, pixel, TILE_SLICE, &score);
+    atomic_fetch_add(&job->spent, score);
+    if (pixel >= 0 &&
+        (atomic_load(&job->spent) > job->max || cancelled(job->params))) {
+      // (Stopped partway, so the tile isn't done, but what it got through
+      // stays in iters)
+      return 1;
     }
-    double coordinateX = posX + (x++) * zoom;
-    double coordinateY = posY + y * zoom;
+  } while (pixel >= 0);
+  if (job->done) {
+    job->done[task] = 1;
+  }
+  atomic_fetch_add(&job->finished, 1);
+  return 0;
+}
 
-    float n;
-    // Run the function needed and also look at the darken effect
-    switch (darkenEffect) {
-      case 0:
-        switch (type) {
-          case 0:
-            n = mand(iterations, coordinateX, coordinateY);
-            break;
-          case 1:
-            n = mand3(iterations, coordinateX, coordinateY);
-            break;
-          case 2:
-            n = mand4(iterations, coordinateX, coordinateY);
-            break;
-          case 3:
-            n = mand5(iterations, coordinateX, coordinateY);
-            break;
-          case 4:
-            n = mand6(iterations, coordinateX, coordinateY);
-            break;
-          case 5:
-            n = mand7(iterations, coordinateX, coordinateY);
-            break;
-          case 6:
-            n = ship(iterations, coordinateX, coordinateY);
-            break;
-          case 7:
-            n = ship3(iterations, coordinateX, coordinateY);
-            break;
-          case 8:
-            n = ship4(iterations, coordinateX, coordinateY);
-            break;
-          case 9:
-            n = celt(iterations, coordinateX, coordinateY);
-            break;
-          case 10:
-            n = prmb(iterations, coordinateX, coordinateY);
-            break;
-          case 11:
-            n = buff(iterations, coordinateX, coordinateY);
-            break;
-          case 12:
-            n = tric(iterations, coordinateX, coordinateY);
-            break;
-          case 13:
-            n = mbbs(iterations, coordinateX, coordinateY);
-            break;
-          case 14:
-            n = mbbs3(iterations, coordinateX, coordinateY);
-            break;
-          case 15:
-            n = mbbs4(iterations, coordinateX, coordinateY);
-        }
-        break;
-      case 3:
-        switch (type) {
-          case 0:
-            n = mandS2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 1:
-            n = mand3S2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 2:
-            n = mand4S2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 3:
-            n = mand5S2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 4:
-            n = mand6S2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 5:
-            n = mand7S2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 6:
-            n = shipS2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 7:
-            n = ship3S2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 8:
-            n = ship4S2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 9:
-            n = celtS2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 10:
-            n = prmbS2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 11:
-            n = buffS2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 12:
-            n = tricS2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 13:
-            n = mbbsS2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 14:
-            n = mbbs3S2(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 15:
-            n = mbbs4S2(iterations, coordinateX, coordinateY, ptr);
-        }
-        break;
-      default:
-        switch (type) {
-          case 0:
-            n = mandS(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 1:
-            n = mand3S(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 2:
-            n = mand4S(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 3:
-            n = mand5S(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 4:
-            n = mand6(iterations, coordinateX, coordinateY);
-            break;
-          case 5:
-            n = mand7(iterations, coordinateX, coordinateY);
-            break;
-          case 6:
-            n = shipS(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 7:
-            n = ship3S(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 8:
-            n = ship4S(iterations, coordinateX, coordinateY, ptr);
-            break;
-          case 9:
-            n = celt(iterations, coordinateX, coordinateY);
-            break;
-          case 10:
-            n = prmb(iterations, coordinateX, coordinateY);
-            break;
-          case 11:
-            n = buff(iterations, coordinateX, coordinateY);
-            break;
-          case 12:
-            n = tric(iterations, coordinateX, coordinateY);
-            break;
-          case 13:
-            n = mbbs(iterations, coordinateX, coordinateY);
-            break;
-          case 14:
-            n = mbbs3(iterations, coordinateX, coordinateY);
-            break;
-          case 15:
-            n = mbbs4(iterations, coordinateX, coordinateY);
-        }
-    }
-    // Cost increases are pre-computed to be as stable as possible (at least for
-    // my computer)
-    if (n == -999.0f) {
-      score += biggerIterations;
-      colors[i] = interiorColor;
-      iters[i] = -999.0;
-    }
-    // What's this number? If flog2() has a value less than this, it gives a
-    // negative number, which will cause problems.
-    else if (n < 1.000004f) {
-      int index = flowAmount;
-      int indexModulo = index % palleteLength;
-      float l = *ptr;
-      colors[i] = mix2(pallete[indexModulo], pallete[indexModulo + 1],
-                       flowAmount - index, renderMode,
-                       darkenEffect == 2 ? 1.0f - l : l);
-      iters[i] = 1.0f;
-    } else {
-      score += 13 + (int)n;
-      float l = *ptr;
-      colors[i] = getPallete(flog2(n) * speed1 + (n - 1) * speed2 + flowAmount,
-                             pallete, palleteLength, renderMode,
-                             darkenEffect == 2 ? 1.0f - l : l);
-      iters[i] = n;
-    }
-    if (score > max) {
-      return i;
-    }
-  } while (++i != limit);
-  // Tell the script that it has completed!
-  return -1;
-}
\ No newline at end of file
+// Native counterpart of run(): splits the frame into tileSize x tileSize tiles
+// and renders them on the pool, writing to the same iters and colors layout.
+// Interior-heavy tiles can cost a hundred times more than exterior ones, which
+// is why the tiles are stolen rather than striped. All workers share the max
+// budget (in the same units as run()'s score); a tile can stop partway, once
+// its slice (TILE_SLICE) is spent, so a call can overshoot it by about one
+// slice per worker. A tile that stopped partway isn't done, but it only has to
+// recolor what it got through.
+//
+// done is optional: it holds one byte per tile (zeroed for a new frame) and
+// lets a call that ran out of budget resume without revisiting the finished
+// tiles. Returns -1 once every tile is done, or else the number of tiles that
+// are left.
+extern int runTiles(TilePool *pool, const RenderParams *p, int tileSize,
+                    int max, unsigned char *done) {
+  // This is a render too as far as cancelRenders() goes (unless p says which
+  // generation it is already)
+  RenderParams params = *p;
+  if (!params.generation) {
+    params.generation = currentGeneration();
+  }
+  TileJob job;
+  job.params = &params;
+  job.tileSize = tileSize < 1 ? 64 : tileSize;
+  job.tilesX = (p->w + job.tileSize - 1) / job.tileSize;
+  job.max = max;
+  atomic_init(&job.spent, 0);
+  atomic_init(&job.finished, 0);
+  job.done = done;
+  preparePalette(&params);
+  int tiles = job.tilesX * ((p->h + job.tileSize - 1) / job.tileSize);
+  if (!runPoolTasks(pool, tiles, renderTileTask, &job)) {
+    return -1;
+  }
+  return tiles - atomic_load(&job.finished);
+}
+
+// Rows per task for recolorThreaded()
+#define RECOLOR_ROWS 16
+
+static int recolorTask(void *context, int task, int worker) {
+  const RenderParams *p = context;
+  (void)worker;
+  int end = (task + 1) * RECOLOR_ROWS < p->h ? (task + 1) * RECOLOR_ROWS : p->h;
+  recolorKernel(p, task * RECOLOR_ROWS * p->w, end * p->w);
+  return 0;
+}
+
+// Native counterpart of recolor(), in bands of rows on the pool
+extern void recolorThreaded(TilePool *pool, const RenderParams *p) {
+  RenderParams params = *p;
+  preparePalette(&params);
+  runPoolTasks(pool, (p->h + RECOLOR_ROWS - 1) / RECOLOR_ROWS, recolorTask,
+               &params);
+}
+#endif
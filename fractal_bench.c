@@ -0,0 +1,450 @@
+/*
+  A native benchmark for fractal.c, so it can be timed outside the browser. It
+  builds the exact same source (just not as WASM):
+
+    cc -O2 fractal_bench.c -o fractal_bench -lm -lpthread
+    ./fractal_bench > bench.jsonl
+
+  Every view in the catalog below is rendered with every formula and every
+  darken effect, and each case prints one line of JSON. Passing the output of
+  an older build with --against lists the cases that got slower (and exits
+  with 1 if there are any), which is handy before shipping a new WASM build.
+  --stats renders each case once more with the render statistics on and adds
+  them to its line, and --heatmap DIR also saves each case's cost heatmap.
+  --slice US renders each case once more with runTimed() in slices of US
+  microseconds, and adds how long the calls really took. --precision forces
+  the kernels to floats (0), doubles (1) or double-doubles (2) rather than
+  picking them by zoom.
+
+  --check doesn't time anything: it renders the overview and a seahorse
+  valley view with runSubdivided() and with run() for every formula, prints
+  how many pixels came out another color (or band), and exits with 1 if
+  they disagree by more than the subdivision's filling can explain.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fractal.c"
+
+// The reference views. Widths are in fractal units across the whole image.
+typedef struct {
+  const char *name;
+  double centerX;
+  double centerY;
+  double width;
+  int iterations;
+} BenchView;
+
+static const BenchView views[] = {
+    // The whole set, mostly escaping quickly
+    {"shallow", -0.5, 0.0, 3.5, 500},
+    // Lots of boundary, where neighboring pixels escape far apart
+    {"seahorse", -0.7453, 0.1127, 0.01, 2000},
+    // Mostly inside the set, so mostly the cycle check and the bulb test
+    {"interior", -0.3, 0.0, 1.2, 5000},
+    // Deep enough that escaping takes thousands of iterations
+    {"deep", -0.743643887037151, 0.131825904205330, 3e-9, 20000}};
+
+#define VIEW_COUNT (int)(sizeof(views) / sizeof(views[0]))
+
+// The palette the viewer starts with
+static uint32_t benchPallete[] = {0xff0a0aa0, 0xff3232ff, 0xff00c8ff,
+                                  0xff00b43c, 0xffdcb428, 0xff7d643c,
+                                  0xffdcc8c8, 0xffc864aa, 0xff820a8c,
+                                  0xff7d00b9, 0xff375ff5, 0xff14a0e6,
+                                  0xff0a0aa0};
+
+typedef struct {
+  double seconds;
+  // What run() charges the score for the frame
+  long long score;
+  // Interior pixels count as the whole iteration limit here (just like in the
+  // score), even when the cycle check let them stop early
+  long long iterations;
+} BenchResult;
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Render a whole view from scratch
+static void renderView(const BenchView *view, int type, int darkenEffect,
+                       int w, int h, float *iters, uint32_t *colors) {
+  double zoom = view->width / w;
+  memset(iters, 0, sizeof(float) * 2 * w * h);
+  // (Big frames at high iterations can take more than one call)
+  int pixel = 0;
+  do {
+    pixel = run(type, w, h, pixel, view->centerX - zoom * w / 2,
+                view->centerY - zoom * h / 2, zoom, INT_MAX, iters, colors,
+                view->iterations, benchPallete, 12, 0xff000000, 0,
+                darkenEffect, 1.0f, 0.0f);
+  } while (pixel != -1);
+}
+
+// Render one case repeat times and keep the fastest
+static BenchResult benchCase(const BenchView *view, int type, int darkenEffect,
+                             int w, int h, int repeat, float *iters,
+                             uint32_t *colors) {
+  BenchResult result = {0};
+  for (int k = 0; k < repeat; k++) {
+    double start = now();
+    renderView(view, type, darkenEffect, w, h, iters, colors);
+    double seconds = now() - start;
+    if (!k || seconds < result.seconds) {
+      result.seconds = seconds;
+    }
+  }
+  // The same accounting as settlePixel(), worked out from what's left in iters
+  result.score = 0;
+  result.iterations = 0;
+  for (int i = 0; i < w * h; i++) {
+    float n = iters[i];
+    if (n == -999.0f) {
+      result.score += view->iterations + 2;
+      result.iterations += view->iterations;
+    } else if (n != 1.0f) {
+      result.score += 13 + (int)n;
+      result.iterations += (int)n;
+    }
+  }
+  return result;
+}
+
+// Render a whole view with runTimed(), slice microseconds at a time, and print
+// how long the calls took. The last call is left out, as it just finishes
+// whatever is left of the frame.
+static void printSlices(const BenchView *view, int type, int darkenEffect,
+                        int w, int h, double slice, float *iters,
+                        uint32_t *colors) {
+  double zoom = view->width / w;
+  memset(iters, 0, sizeof(float) * 2 * w * h);
+  int calls = 0;
+  double total = 0;
+  double worst = 0;
+  int pixel = 0;
+  while (pixel != -1) {
+    double start = now();
+    pixel = runTimed(type, w, h, pixel, view->centerX - zoom * w / 2,
+                     view->centerY - zoom * h / 2, zoom, slice, iters, colors,
+                     view->iterations, benchPallete, 12, 0xff000000, 0,
+                     darkenEffect, 1.0f, 0.0f);
+    double microseconds = (now() - start) * 1e6;
+    if (pixel != -1) {
+      calls++;
+      total += microseconds;
+      worst = microseconds > worst ? microseconds : worst;
+    }
+  }
+  printf(", \"slice\": %.1f, \"sliceCalls\": %d, "
+         "\"sliceMeanMicroseconds\": %.1f, \"sliceWorstMicroseconds\": %.1f",
+         slice, calls, calls ? total / calls : 0.0, worst);
+}
+
+// Print the render statistics of one case (and save its heatmap, if there's
+// somewhere to put it). This is a separate render, since timing the kernels
+// slows them down a little.
+static void printStats(const BenchView *view, int type, int darkenEffect,
+                       int w, int h, float *iters, uint32_t *colors,
+                       uint32_t *cost, const char *heatmapDir) {
+  RenderStats stats = {0};
+  stats.cost = cost;
+  if (cost) {
+    memset(cost, 0, sizeof(uint32_t) * w * h);
+  }
+  setRenderStats(&stats);
+  renderView(view, type, darkenEffect, w, h, iters, colors);
+  setRenderStats(NULL);
+  long long pixels = stats.escaped + stats.interior;
+  printf(", \"escaped\": %lld, \"interior\": %lld, \"interiorRatio\": %.4f, "
+         "\"executedIterations\": %lld, \"score\": %lld, "
+         "\"formulaSeconds\": %.6f, \"colorSeconds\": %.6f, "
+         "\"histogram\": [",
+         stats.escaped, stats.interior,
+         pixels ? (double)stats.interior / pixels : 0.0, stats.iterations,
+         stats.score, stats.formulaNanoseconds * 1e-9,
+         stats.colorNanoseconds * 1e-9);
+  for (int k = 0; k < STATS_BINS; k++) {
+    printf(k ? ", %lld" : "%lld", stats.histogram[k]);
+  }
+  printf("]");
+  if (!heatmapDir) {
+    return;
+  }
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s-%d-%d.ppm", heatmapDir, view->name, type,
+           darkenEffect);
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    perror(path);
+    return;
+  }
+  statsHeatmap(&stats, w, h, colors);
+  fprintf(file, "P6\n%d %d\n255\n", w, h);
+  for (int i = 0; i < w * h; i++) {
+    unsigned char rgb[3] = {getR(colors[i]), getG(colors[i]), getB(colors[i])};
+    fwrite(rgb, 1, 3, file);
+  }
+  fclose(file);
+}
+
+// The views --check compares on: the overview the viewer opens on, and a
+// deeper one in the seahorse valley where the colors change quickly (and in
+// renderMode 1), which is where the filled colors are furthest off
+typedef struct {
+  const char *name;
+  int w;
+  int h;
+  double posX;
+  double posY;
+  double zoom;
+  int iterations;
+  int renderMode;
+  // Whether more than one pixel in a thousand over 32 levels off fails it
+  int strict;
+} CheckView;
+
+static const CheckView checkViews[] = {
+    {"overview", 320, 240, -2.5, -1.5, 4.0 / 320, 1000, 0, 1},
+    {"seahorse", 203, 131, -0.745 - 101.5e-5, 0.11 - 65.5e-5, 1e-5, 800, 1,
+     0},
+};
+
+// The largest difference between two colors on any channel
+static int colorDistance(uint32_t a, uint32_t b) {
+  int most = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    int difference = (int)((a >> shift) & 255) - (int)((b >> shift) & 255);
+    difference = difference < 0 ? -difference : difference;
+    most = difference > most ? difference : most;
+  }
+  return most;
+}
+
+// Compare runSubdivided() with run() on the check views, for every formula.
+// The filled rectangles are only approximate, so plenty of pixels come out a
+// slightly different color (all of them are counted, along with those in a
+// different band), but the flow color has to be exactly where run() puts it,
+// and on the overview hardly anything should be far off. Returns how many
+// cases failed.
+static int checkSubdivided(void) {
+  int most = 0;
+  for (size_t v = 0; v < sizeof(checkViews) / sizeof(checkViews[0]); v++) {
+    int pixels = checkViews[v].w * checkViews[v].h;
+    most = pixels > most ? pixels : most;
+  }
+  float *expected = malloc(sizeof(float) * 2 * most);
+  float *actual = malloc(sizeof(float) * 2 * most);
+  uint32_t *expectedColors = malloc(sizeof(uint32_t) * most);
+  uint32_t *actualColors = malloc(sizeof(uint32_t) * most);
+  if (!expected || !actual || !expectedColors || !actualColors) {
+    fprintf(stderr, "out of memory\n");
+    exit(2);
+  }
+  int failed = 0;
+  for (size_t v = 0; v < sizeof(checkViews) / sizeof(checkViews[0]); v++) {
+    const CheckView *view = &checkViews[v];
+    int w = view->w, h = view->h;
+    for (int type = 0; type < 16; type++) {
+      memset(expected, 0, sizeof(float) * 2 * w * h);
+      memset(actual, 0, sizeof(float) * 2 * w * h);
+      run(type, w, h, 0, view->posX, view->posY, view->zoom, INT_MAX,
+          expected, expectedColors, view->iterations, benchPallete, 12,
+          0xff000000, view->renderMode, 0, 1.0f, 0.0f);
+      runSubdivided(type, w, h, 0, view->posX, view->posY, view->zoom,
+                    INT_MAX, actual, actualColors, view->iterations,
+                    benchPallete, 12, 0xff000000, view->renderMode, 0, 1.0f,
+                    0.0f);
+      int flow = 0;
+      int bands = 0;
+      int colors = 0;
+      int far = 0;
+      for (int i = 0; i < w * h; i++) {
+        int distance = colorDistance(expectedColors[i], actualColors[i]);
+        flow += (expected[i] == 1.0f) != (actual[i] == 1.0f);
+        bands += bandOf(expected[i]) != bandOf(actual[i]);
+        colors += distance > 0;
+        far += distance > 32;
+      }
+      // (Up to one pixel in a thousand far off)
+      int ok = !flow && (!view->strict || far * 1000 <= w * h);
+      printf("%s type %d: %d flow pixels wrong, %d in another band, %d of %d "
+             "another color, %d over 32 levels off%s\n",
+             view->name, type, flow, bands, colors, w * h, far,
+             ok ? "" : " FAILED");
+      failed += !ok;
+    }
+  }
+  free(expected);
+  free(actual);
+  free(expectedColors);
+  free(actualColors);
+  return failed;
+}
+
+// Look a case up in the output of an earlier run. Returns its Mpixels/s, or 0
+// if it isn't there.
+static double previousRate(FILE *file, const char *view, int type,
+                           int darkenEffect) {
+  char line[512];
+  rewind(file);
+  while (fgets(line, sizeof(line), file)) {
+    char name[64];
+    int oldType, oldEffect;
+    double rate;
+    if (sscanf(line,
+               "{\"view\": \"%63[^\"]\", \"type\": %d, \"darkenEffect\": %d, "
+               "\"mpixelsPerSecond\": %lf",
+               name, &oldType, &oldEffect, &rate) == 4 &&
+        !strcmp(name, view) && oldType == type && oldEffect == darkenEffect) {
+      return rate;
+    }
+  }
+  return 0;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: fractal_bench [--size WxH] [--repeat N] [--view NAME] "
+          "[--type N]\n"
+          "                     [--against OLD.jsonl] [--tolerance PERCENT]\n"
+          "                     [--stats] [--heatmap DIR] [--slice US]\n"
+          "                     [--precision N]\n"
+          "       fractal_bench --check\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int w = 256;
+  int h = 192;
+  int repeat = 3;
+  const char *onlyView = NULL;
+  int onlyType = -1;
+  const char *against = NULL;
+  double tolerance = 5;
+  int withStats = 0;
+  const char *heatmapDir = NULL;
+  double slice = 0;
+  for (int k = 1; k < argc; k++) {
+    if (!strcmp(argv[k], "--stats")) {
+      withStats = 1;
+      continue;
+    }
+    if (!strcmp(argv[k], "--check")) {
+      return checkSubdivided() ? 1 : 0;
+    }
+    if (k + 1 == argc) {
+      usage();
+    }
+    if (!strcmp(argv[k], "--size")) {
+      if (sscanf(argv[++k], "%dx%d", &w, &h) != 2 || w < 1 || h < 1) {
+        usage();
+      }
+    } else if (!strcmp(argv[k], "--repeat")) {
+      repeat = atoi(argv[++k]);
+      if (repeat < 1) {
+        usage();
+      }
+    } else if (!strcmp(argv[k], "--view")) {
+      onlyView = argv[++k];
+    } else if (!strcmp(argv[k], "--type")) {
+      onlyType = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--against")) {
+      against = argv[++k];
+    } else if (!strcmp(argv[k], "--tolerance")) {
+      tolerance = atof(argv[++k]);
+    } else if (!strcmp(argv[k], "--heatmap")) {
+      heatmapDir = argv[++k];
+      withStats = 1;
+    } else if (!strcmp(argv[k], "--precision")) {
+      setPrecision(atoi(argv[++k]));
+    } else if (!strcmp(argv[k], "--slice")) {
+      slice = atof(argv[++k]);
+      if (slice <= 0) {
+        usage();
+      }
+    } else {
+      usage();
+    }
+  }
+
+  FILE *old = NULL;
+  if (against && !(old = fopen(against, "r"))) {
+    perror(against);
+    return 2;
+  }
+  float *iters = malloc(sizeof(float) * 2 * w * h);
+  uint32_t *colors = malloc(sizeof(uint32_t) * w * h);
+  uint32_t *cost = heatmapDir ? malloc(sizeof(uint32_t) * w * h) : NULL;
+  if (!iters || !colors || (heatmapDir && !cost)) {
+    fprintf(stderr, "out of memory\n");
+    return 2;
+  }
+
+  // Warm up first, so the first case doesn't pay for building the palette table
+  // and picking the kernels (or measuring the cost model)
+  benchCase(views, 0, 0, w < 16 ? w : 16, h < 16 ? h : 16, 1, iters, colors);
+  if (slice) {
+    calibrateTimed(benchPallete, 12, 0xff000000, 0);
+  }
+
+  int slower = 0;
+  for (int v = 0; v < VIEW_COUNT; v++) {
+    if (onlyView && strcmp(onlyView, views[v].name)) {
+      continue;
+    }
+    for (int type = 0; type < 16; type++) {
+      if (onlyType >= 0 && type != onlyType) {
+        continue;
+      }
+      for (int darkenEffect = 0; darkenEffect < 4; darkenEffect++) {
+        BenchResult result = benchCase(views + v, type, darkenEffect, w, h,
+                                       repeat, iters, colors);
+        double microseconds = result.seconds * 1e6;
+        double rate = w * h / microseconds;
+        printf("{\"view\": \"%s\", \"type\": %d, \"darkenEffect\": %d, "
+               "\"mpixelsPerSecond\": %.4f, \"iterationsPerSecond\": %.6g, "
+               "\"scorePerMicrosecond\": %.4f, \"seconds\": %.6f, "
+               "\"width\": %d, \"height\": %d, \"iterations\": %d",
+               views[v].name, type, darkenEffect, rate,
+               result.iterations / result.seconds,
+               result.score / microseconds, result.seconds, w, h,
+               views[v].iterations);
+        if (withStats) {
+          printStats(views + v, type, darkenEffect, w, h, iters, colors, cost,
+                     heatmapDir);
+        }
+        if (slice) {
+          printSlices(views + v, type, darkenEffect, w, h, slice, iters,
+                      colors);
+        }
+        printf("}\n");
+        fflush(stdout);
+        if (old) {
+          double before = previousRate(old, views[v].name, type, darkenEffect);
+          if (before && rate < before * (1 - tolerance / 100)) {
+            fprintf(stderr, "slower: %s type %d darkenEffect %d: %.3f -> "
+                    "%.3f Mpixels/s (%.1f%%)\n",
+                    views[v].name, type, darkenEffect, before, rate,
+                    (rate / before - 1) * 100);
+            slower++;
+          }
+        }
+      }
+    }
+  }
+  if (old) {
+    fprintf(stderr, "%d case%s slower than %s\n", slower,
+            slower == 1 ? "" : "s", against);
+    fclose(old);
+  }
+  free(iters);
+  free(colors);
+  free(cost);
+  return slower ? 1 : 0;
+}
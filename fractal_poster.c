@@ -0,0 +1,375 @@
+/*
+  Headless poster rendering with fractal.c, for images far too big for run()'s
+  buffers (a 32768x32768 frame would need about 12 GB of iters and colors):
+
+    cc -O2 fractal_poster.c -o fractal_poster -lm -lpthread -lz
+    ./fractal_poster --size 32768x32768 --center -0.75,0 --width 3 poster.png
+
+  The image is rendered in bands of full rows, each band split into tiles on
+  the thread pool like runTiles() always does, and every finished band is
+  handed to a writer thread that encodes it while the next band renders. The
+  output is a PNG (deflated with zlib) when the name ends in .png, a binary PPM
+  when it ends in .ppm, and raw RGB bytes otherwise. Memory stays at one band
+  of iters and two bands of colors (about --band-pixels * 16 bytes) whatever
+  the size of the image.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "fractal.c"
+
+// The palette the viewer starts with
+static uint32_t posterPallete[] = {0xff0a0aa0, 0xff3232ff, 0xff00c8ff,
+                                   0xff00b43c, 0xffdcb428, 0xff7d643c,
+                                   0xffdcc8c8, 0xffc864aa, 0xff820a8c,
+                                   0xff7d00b9, 0xff375ff5, 0xff14a0e6,
+                                   0xff0a0aa0};
+
+// How many pixels a band has (at least one row of them)
+#define BAND_PIXELS (1 << 22)
+// How much deflated data goes into each IDAT chunk
+#define CHUNK_BYTES (1 << 16)
+
+enum { FORMAT_PNG, FORMAT_PPM, FORMAT_RAW };
+
+// -----
+
+// Encoding. Everything here runs on the writer thread, one band at a time.
+
+typedef struct {
+  FILE *file;
+  int format;
+  int w;
+  int h;
+  // One row of RGB with its PNG filter byte in front, and the row before it
+  unsigned char *row;
+  unsigned char *previous;
+  z_stream stream;
+  unsigned char *chunk;
+  int failed;
+} Encoder;
+
+static void writeBytes(Encoder *encoder, const void *data, size_t length) {
+  if (!encoder->failed && fwrite(data, 1, length, encoder->file) != length) {
+    encoder->failed = 1;
+  }
+}
+
+static void writeBigEndian(Encoder *encoder, uint32_t value) {
+  unsigned char bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+  writeBytes(encoder, bytes, 4);
+}
+
+static void writeChunk(Encoder *encoder, const char *type,
+                       const unsigned char *data, uint32_t length) {
+  writeBigEndian(encoder, length);
+  writeBytes(encoder, type, 4);
+  writeBytes(encoder, data, length);
+  uLong crc = crc32(0, (const Bytef *)type, 4);
+  if (length) {
+    crc = crc32(crc, data, length);
+  }
+  writeBigEndian(encoder, crc);
+}
+
+// Write out whatever deflate has produced, as IDAT chunks. Returns the zlib
+// status (Z_STREAM_END once flush is Z_FINISH and it's all out).
+static int deflateRow(Encoder *encoder, const unsigned char *data,
+                      size_t length, int flush) {
+  z_stream *stream = &encoder->stream;
+  stream->next_in = (Bytef *)data;
+  stream->avail_in = length;
+  int status;
+  do {
+    status = deflate(stream, flush);
+    if (status == Z_STREAM_ERROR) {
+      encoder->failed = 1;
+      return status;
+    }
+    if (!stream->avail_out || status == Z_STREAM_END) {
+      writeChunk(encoder, "IDAT", encoder->chunk,
+                 CHUNK_BYTES - stream->avail_out);
+      stream->next_out = encoder->chunk;
+      stream->avail_out = CHUNK_BYTES;
+    }
+  } while (stream->avail_in || (flush == Z_FINISH && status != Z_STREAM_END));
+  return status;
+}
+
+static int beginImage(Encoder *encoder, FILE *file, int format, int w, int h,
+                      int level) {
+  *encoder = (Encoder){.file = file, .format = format, .w = w, .h = h};
+  encoder->row = calloc(1, 3 * (size_t)w + 1);
+  encoder->previous = calloc(1, 3 * (size_t)w + 1);
+  encoder->chunk = malloc(CHUNK_BYTES);
+  if (!encoder->row || !encoder->previous || !encoder->chunk) {
+    return 0;
+  }
+  if (format == FORMAT_PPM) {
+    fprintf(file, "P6\n%d %d\n255\n", w, h);
+  } else if (format == FORMAT_PNG) {
+    static const unsigned char signature[8] = {0x89, 'P',  'N',  'G',
+                                               '\r', '\n', 0x1a, '\n'};
+    // 8 bits a channel, RGB, no interlacing
+    unsigned char header[13] = {w >> 24, w >> 16, w >> 8, w, h >> 24,
+                                h >> 16, h >> 8,  h,      8, 2};
+    writeBytes(encoder, signature, 8);
+    writeChunk(encoder, "IHDR", header, 13);
+    if (deflateInit(&encoder->stream, level) != Z_OK) {
+      return 0;
+    }
+    encoder->stream.next_out = encoder->chunk;
+    encoder->stream.avail_out = CHUNK_BYTES;
+  }
+  return !encoder->failed;
+}
+
+// Encode rows of colors. PNG rows use the Up filter (each byte minus the one
+// above it), which turns the smooth bands into runs of small numbers.
+static void encodeRows(Encoder *encoder, const uint32_t *colors, int rows) {
+  int w = encoder->w;
+  unsigned char *row = encoder->row;
+  for (int y = 0; y < rows && !encoder->failed; y++) {
+    const uint32_t *line = colors + (size_t)y * w;
+    unsigned char *rgb = row + 1;
+    for (int x = 0; x < w; x++) {
+      rgb[3 * x] = getR(line[x]);
+      rgb[3 * x + 1] = getG(line[x]);
+      rgb[3 * x + 2] = getB(line[x]);
+    }
+    if (encoder->format != FORMAT_PNG) {
+      writeBytes(encoder, rgb, 3 * (size_t)w);
+      continue;
+    }
+    unsigned char *previous = encoder->previous;
+    for (size_t k = 1; k <= 3 * (size_t)w; k++) {
+      unsigned char value = row[k];
+      row[k] = value - previous[k];
+      previous[k] = value;
+    }
+    row[0] = 2;
+    deflateRow(encoder, row, 3 * (size_t)w + 1, Z_NO_FLUSH);
+  }
+}
+
+// Finish the file. Returns 0 if anything went wrong writing it.
+static int endImage(Encoder *encoder) {
+  if (encoder->format == FORMAT_PNG) {
+    deflateRow(encoder, NULL, 0, Z_FINISH);
+    deflateEnd(&encoder->stream);
+    writeChunk(encoder, "IEND", NULL, 0);
+  }
+  free(encoder->row);
+  free(encoder->previous);
+  free(encoder->chunk);
+  return !encoder->failed;
+}
+
+// -----
+
+// The pipeline. Bands alternate between two slots: the renderer fills one
+// while the writer empties the other, and each waits for the other when it
+// gets ahead.
+
+typedef struct {
+  uint32_t *colors[2];
+  int rows[2];
+  int full[2];
+  int finished;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  Encoder *encoder;
+} Pipeline;
+
+static void *writerThread(void *argument) {
+  Pipeline *pipeline = argument;
+  pthread_mutex_lock(&pipeline->lock);
+  for (int slot = 0;; slot ^= 1) {
+    while (!pipeline->full[slot] && !pipeline->finished) {
+      pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+    if (!pipeline->full[slot]) {
+      break;
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    encodeRows(pipeline->encoder, pipeline->colors[slot], pipeline->rows[slot]);
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->full[slot] = 0;
+    pthread_cond_broadcast(&pipeline->changed);
+  }
+  pthread_mutex_unlock(&pipeline->lock);
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: fractal_poster [--size WxH] [--center X,Y] [--width W]\n"
+          "                      [--type N] [--iterations N] [--darken N]\n"
+          "                      [--threads N] [--band-pixels N] [--level N]\n"
+          "                      OUT.png|OUT.ppm|OUT.raw\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int w = 8192;
+  int h = 8192;
+  double centerX = -0.75;
+  double centerY = 0;
+  double width = 3;
+  int type = 0;
+  int iterations = 1000;
+  int darkenEffect = 0;
+  int threads = 0;
+  long bandPixels = BAND_PIXELS;
+  int level = Z_BEST_SPEED;
+  const char *out = NULL;
+  for (int k = 1; k < argc; k++) {
+    if (argv[k][0] != '-') {
+      if (out) {
+        usage();
+      }
+      out = argv[k];
+      continue;
+    }
+    if (k + 1 == argc) {
+      usage();
+    }
+    if (!strcmp(argv[k], "--size")) {
+      if (sscanf(argv[++k], "%dx%d", &w, &h) != 2 || w < 1 || h < 1) {
+        usage();
+      }
+    } else if (!strcmp(argv[k], "--center")) {
+      if (sscanf(argv[++k], "%lf,%lf", &centerX, &centerY) != 2) {
+        usage();
+      }
+    } else if (!strcmp(argv[k], "--width")) {
+      width = atof(argv[++k]);
+    } else if (!strcmp(argv[k], "--type")) {
+      type = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--iterations")) {
+      iterations = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--darken")) {
+      darkenEffect = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--threads")) {
+      threads = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--band-pixels")) {
+      bandPixels = atol(argv[++k]);
+    } else if (!strcmp(argv[k], "--level")) {
+      level = atoi(argv[++k]);
+    } else {
+      usage();
+    }
+  }
+  if (!out || width <= 0 || type < 0 || type > 15 || iterations < 1 ||
+      darkenEffect < 0 || darkenEffect > 3 || level < 0 || level > 9) {
+    usage();
+  }
+  size_t length = strlen(out);
+  int format = length > 4 && !strcmp(out + length - 4, ".png")   ? FORMAT_PNG
+               : length > 4 && !strcmp(out + length - 4, ".ppm") ? FORMAT_PPM
+                                                                 : FORMAT_RAW;
+  if (threads < 1) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  int bandRows = bandPixels / w;
+  bandRows = bandRows < 1 ? 1 : bandRows > h ? h : bandRows;
+
+  size_t bandSize = (size_t)w * bandRows;
+  float *iters = malloc(sizeof(float) * 2 * bandSize);
+  Pipeline pipeline = {.colors = {malloc(sizeof(uint32_t) * bandSize),
+                                  malloc(sizeof(uint32_t) * bandSize)}};
+  TilePool *pool = createTilePool(threads);
+  FILE *file = fopen(out, "wb");
+  if (!file) {
+    perror(out);
+    return 1;
+  }
+  Encoder encoder;
+  if (!iters || !pipeline.colors[0] || !pipeline.colors[1] || !pool ||
+      !beginImage(&encoder, file, format, w, h, level)) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  pipeline.encoder = &encoder;
+  pthread_mutex_init(&pipeline.lock, NULL);
+  pthread_cond_init(&pipeline.changed, NULL);
+  pthread_t writer;
+  if (pthread_create(&writer, NULL, writerThread, &pipeline)) {
+    fprintf(stderr, "can't start the writer thread\n");
+    return 1;
+  }
+
+  double zoom = width / w;
+  double started = now();
+  double waited = 0;
+  int bands = 0;
+  for (int top = 0; top < h; top += bandRows, bands++) {
+    int slot = bands & 1;
+    int rows = top + bandRows < h ? bandRows : h - top;
+    double waitStarted = now();
+    pthread_mutex_lock(&pipeline.lock);
+    while (pipeline.full[slot]) {
+      pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+    }
+    pthread_mutex_unlock(&pipeline.lock);
+    waited += now() - waitStarted;
+
+    memset(iters, 0, sizeof(float) * 2 * (size_t)w * rows);
+    RenderParams p = {.type = type,
+                      .w = w,
+                      .h = rows,
+                      .posX = centerX - w * 0.5 * zoom,
+                      .posY = centerY + (top - h * 0.5) * zoom,
+                      .zoom = zoom,
+                      .iters = iters,
+                      .colors = pipeline.colors[slot],
+                      .iterations = iterations,
+                      .pallete = posterPallete,
+                      .palleteLength = 12,
+                      .interiorColor = 0xff000000,
+                      .darkenEffect = darkenEffect,
+                      .speed = 1.0f};
+    // (A band can cost more than one call's budget at high iterations; the
+    // tiles that are done already only get recolored)
+    while (runTiles(pool, &p, 64, INT_MAX, NULL) != -1) {
+    }
+
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.rows[slot] = rows;
+    pipeline.full[slot] = 1;
+    pthread_cond_broadcast(&pipeline.changed);
+    pthread_mutex_unlock(&pipeline.lock);
+  }
+  pthread_mutex_lock(&pipeline.lock);
+  pipeline.finished = 1;
+  pthread_cond_broadcast(&pipeline.changed);
+  pthread_mutex_unlock(&pipeline.lock);
+  pthread_join(writer, NULL);
+
+  int written = endImage(&encoder);
+  if (fclose(file) || !written) {
+    perror(out);
+    return 1;
+  }
+  fprintf(stderr,
+          "%dx%d in %d bands of %d rows: %.2f s (%.2f s waiting for the "
+          "writer), %.1f MB of buffers\n",
+          w, h, bands, bandRows, now() - started, waited,
+          bandSize * (2 * sizeof(float) + 2 * sizeof(uint32_t)) / 1e6);
+  destroyTilePool(pool);
+  free(iters);
+  free(pipeline.colors[0]);
+  free(pipeline.colors[1]);
+  return 0;
+}
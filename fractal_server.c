@@ -0,0 +1,711 @@
+/*
+  A tile server on top of fractal.c, for slippy maps (Leaflet, OpenLayers and
+  so on) pointed at localhost:
+
+    cc -O2 fractal_server.c -o fractal_server -lm -lpthread -lz
+    ./fractal_server --port 8080
+
+  GET /{z}/{x}/{y}.png is tile (x, y) of zoom level z, a 256 pixel PNG. Level
+  0 is one tile covering [-2.5, 1.5] x [-2, 2], and every level splits each
+  tile into four, like the usual web map scheme. GET /stats says how many
+  requests came in, how many tiles were rendered and how many requests got
+  their tile from someone else's render.
+
+  Connections are served by a fixed pool of --connections workers, each taking
+  the next connection off the listening socket, and at most --threads of them
+  render at once (on that many sets of buffers), so a crowd never means more
+  threads or memory than that. When a tile is asked for while it's already
+  being rendered (or waiting its turn to be), the request waits for that
+  render and gets the same PNG rather than starting one of its own (that's the
+  coalescing, which --no-coalesce turns off for comparison). Popular places
+  get asked for by everybody at about the same time, so under load that's a
+  good share of the tiles.
+
+  The same program is the load generator for it:
+
+    ./fractal_server --load 127.0.0.1:8080 --clients 64 --requests 20000
+
+  starts --clients viewers at once, each looking at random levels of a few
+  popular places (a screen's worth of tiles around each one, like a map
+  does), and prints the throughput, the latency and the server's /stats.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "fractal.c"
+
+// The palette the viewer starts with
+static uint32_t serverPallete[] = {0xff0a0aa0, 0xff3232ff, 0xff00c8ff,
+                                   0xff00b43c, 0xffdcb428, 0xff7d643c,
+                                   0xffdcc8c8, 0xffc864aa, 0xff820a8c,
+                                   0xff7d00b9, 0xff375ff5, 0xff14a0e6,
+                                   0xff0a0aa0};
+
+#define TILE_SIZE 256
+// How much of run()'s score a tile gets per call
+#define TILE_BUDGET (1 << 24)
+// Level 0's tile
+#define WORLD_LEFT -2.5
+#define WORLD_TOP -2.0
+#define WORLD_SIZE 4.0
+// Past this, posX and posY of a tile stop being exact doubles
+#define MAX_LEVEL 48
+// Buckets of the table of tiles being rendered
+#define FLIGHT_BUCKETS 256
+// The longest request (line and headers) that's read
+#define REQUEST_BYTES 4096
+
+// -----
+
+// Encoding. Tiles are small, so the whole image is deflated in one go into a
+// single IDAT chunk.
+
+typedef struct {
+  unsigned char *data;
+  size_t length;
+} Buffer;
+
+static void putBigEndian(Buffer *buffer, uint32_t value) {
+  unsigned char *out = buffer->data + buffer->length;
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+  buffer->length += 4;
+}
+
+// Append a chunk whose data is already in place after room for its length and
+// type
+static void finishChunk(Buffer *buffer, const char *type, size_t length) {
+  unsigned char *start = buffer->data + buffer->length;
+  putBigEndian(buffer, length);
+  memcpy(start + 4, type, 4);
+  buffer->length += 4 + length;
+  putBigEndian(buffer, crc32(0, start + 4, 4 + length));
+}
+
+// A PNG of a tile's colors (malloc'd), with every row Up filtered like
+// fractal_poster does. Returns 0 if it ran out of memory.
+static int encodeTile(const uint32_t *colors, int level, Buffer *png) {
+  size_t rowBytes = 3 * TILE_SIZE + 1;
+  unsigned char *rows = malloc(rowBytes * TILE_SIZE);
+  uLong bound = compressBound(rowBytes * TILE_SIZE);
+  // The signature, IHDR, IDAT around the deflated rows, and IEND
+  png->data = malloc(8 + 25 + 12 + bound + 12);
+  png->length = 0;
+  if (!rows || !png->data) {
+    free(rows);
+    free(png->data);
+    return 0;
+  }
+  for (int y = 0; y < TILE_SIZE; y++) {
+    unsigned char *row = rows + y * rowBytes;
+    row[0] = 2;
+    for (int x = 0; x < TILE_SIZE; x++) {
+      uint32_t color = colors[y * TILE_SIZE + x];
+      uint32_t above = y ? colors[(y - 1) * TILE_SIZE + x] : 0;
+      row[1 + 3 * x] = getR(color) - getR(above);
+      row[2 + 3 * x] = getG(color) - getG(above);
+      row[3 + 3 * x] = getB(color) - getB(above);
+    }
+  }
+  static const unsigned char signature[8] = {0x89, 'P',  'N',  'G',
+                                             '\r', '\n', 0x1a, '\n'};
+  memcpy(png->data, signature, 8);
+  png->length = 8;
+  // 8 bits a channel, RGB, no interlacing
+  unsigned char header[13] = {0, 0, TILE_SIZE >> 8, TILE_SIZE & 0xff,
+                              0, 0, TILE_SIZE >> 8, TILE_SIZE & 0xff,
+                              8, 2};
+  memcpy(png->data + png->length + 8, header, 13);
+  finishChunk(png, "IHDR", 13);
+  uLongf deflated = bound;
+  int status = compress2(png->data + png->length + 8, &deflated, rows,
+                         rowBytes * TILE_SIZE, level);
+  free(rows);
+  if (status != Z_OK) {
+    free(png->data);
+    return 0;
+  }
+  finishChunk(png, "IDAT", deflated);
+  finishChunk(png, "IEND", 0);
+  return 1;
+}
+
+// -----
+
+// The server. Tiles being rendered are kept in a small hash table (under one
+// lock) until the last request waiting for them has sent them off.
+
+typedef struct Flight {
+  int level;
+  int64_t x;
+  int64_t y;
+  // Requests holding on to it (the one rendering it included)
+  int holders;
+  int done;
+  Buffer png;
+  struct Flight *next;
+} Flight;
+
+// The buffers one render needs
+typedef struct {
+  float *iters;
+  uint32_t *colors;
+} Renderer;
+
+typedef struct {
+  int listener;
+  int type;
+  int iterations;
+  int darkenEffect;
+  int compression;
+  int coalesce;
+  pthread_mutex_t lock;
+  // Broadcast whenever a tile is done
+  pthread_cond_t finished;
+  Flight *flights[FLIGHT_BUCKETS];
+  // The renderers nobody is using
+  Renderer *idle;
+  int idleCount;
+  pthread_cond_t renderFreed;
+  atomic_long requests;
+  atomic_long rendered;
+  atomic_long coalesced;
+  atomic_long failed;
+} Server;
+
+static inline int flightBucket(int level, int64_t x, int64_t y) {
+  uint64_t hash = (uint64_t)x * 0x9e3779b97f4a7c15ULL ^
+                  (uint64_t)y * 0xc4ceb9fe1a85ec53ULL ^ (uint64_t)level;
+  return (hash >> 32) % FLIGHT_BUCKETS;
+}
+
+// Render a tile into flight->png, once one of the renderers is free
+static void renderTile(Server *server, int level, int64_t x, int64_t y,
+                       Flight *flight) {
+  pthread_mutex_lock(&server->lock);
+  while (!server->idleCount) {
+    pthread_cond_wait(&server->renderFreed, &server->lock);
+  }
+  Renderer renderer = server->idle[--server->idleCount];
+  pthread_mutex_unlock(&server->lock);
+
+  double zoom = ldexp(WORLD_SIZE / TILE_SIZE, -level);
+  memset(renderer.iters, 0, sizeof(float) * 2 * TILE_SIZE * TILE_SIZE);
+  // In slices, as a deep tile can cost more than a score can count
+  int pixel = 0;
+  do {
+    pixel = run(server->type, TILE_SIZE, TILE_SIZE, pixel,
+                WORLD_LEFT + (double)x * TILE_SIZE * zoom,
+                WORLD_TOP + (double)y * TILE_SIZE * zoom, zoom, TILE_BUDGET,
+                renderer.iters, renderer.colors, server->iterations,
+                serverPallete, 12, 0xff000000, 0, server->darkenEffect, 1.0f,
+                0);
+  } while (pixel != -1);
+  if (!encodeTile(renderer.colors, server->compression, &flight->png)) {
+    flight->png = (Buffer){0};
+  }
+  atomic_fetch_add(&server->rendered, 1);
+
+  pthread_mutex_lock(&server->lock);
+  server->idle[server->idleCount++] = renderer;
+  pthread_cond_signal(&server->renderFreed);
+  pthread_mutex_unlock(&server->lock);
+}
+
+// The tile (x, y) of level, rendered here unless some other worker is already
+// at it. Hand it back to releaseTile() once it's been sent.
+static Flight *acquireTile(Server *server, int level, int64_t x, int64_t y) {
+  if (!server->coalesce) {
+    Flight *flight = calloc(1, sizeof(Flight));
+    if (flight) {
+      flight->holders = 1;
+      renderTile(server, level, x, y, flight);
+    }
+    return flight;
+  }
+  Flight **bucket = &server->flights[flightBucket(level, x, y)];
+  pthread_mutex_lock(&server->lock);
+  for (Flight *flight = *bucket; flight; flight = flight->next) {
+    if (flight->level == level && flight->x == x && flight->y == y) {
+      flight->holders++;
+      atomic_fetch_add(&server->coalesced, 1);
+      while (!flight->done) {
+        pthread_cond_wait(&server->finished, &server->lock);
+      }
+      pthread_mutex_unlock(&server->lock);
+      return flight;
+    }
+  }
+  Flight *flight = calloc(1, sizeof(Flight));
+  if (!flight) {
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+  }
+  *flight = (Flight){.level = level, .x = x, .y = y, .holders = 1,
+                     .next = *bucket};
+  *bucket = flight;
+  pthread_mutex_unlock(&server->lock);
+
+  renderTile(server, level, x, y, flight);
+  pthread_mutex_lock(&server->lock);
+  flight->done = 1;
+  pthread_cond_broadcast(&server->finished);
+  pthread_mutex_unlock(&server->lock);
+  return flight;
+}
+
+static void releaseTile(Server *server, Flight *flight) {
+  if (!server->coalesce) {
+    free(flight->png.data);
+    free(flight);
+    return;
+  }
+  pthread_mutex_lock(&server->lock);
+  int last = !--flight->holders;
+  if (last) {
+    Flight **link =
+        &server->flights[flightBucket(flight->level, flight->x, flight->y)];
+    while (*link != flight) {
+      link = &(*link)->next;
+    }
+    *link = flight->next;
+  }
+  pthread_mutex_unlock(&server->lock);
+  if (last) {
+    free(flight->png.data);
+    free(flight);
+  }
+}
+
+static int sendAll(int fd, const void *data, size_t length) {
+  const char *bytes = data;
+  while (length) {
+    ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return 0;
+    }
+    bytes += sent;
+    length -= sent;
+  }
+  return 1;
+}
+
+static void sendResponse(int fd, const char *status, const char *type,
+                         const void *body, size_t length) {
+  char header[256];
+  int headerLength = snprintf(header, sizeof(header),
+                              "HTTP/1.1 %s\r\n"
+                              "Content-Type: %s\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Access-Control-Allow-Origin: *\r\n"
+                              "Connection: close\r\n\r\n",
+                              status, type, length);
+  if (sendAll(fd, header, headerLength)) {
+    sendAll(fd, body, length);
+  }
+}
+
+// Read the request line (and the headers, which don't matter) of a
+// connection. Returns 0 if it never finished.
+static int readRequest(int fd, char *request) {
+  size_t length = 0;
+  while (length < REQUEST_BYTES - 1) {
+    ssize_t got = recv(fd, request + length, REQUEST_BYTES - 1 - length, 0);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return 0;
+    }
+    length += got;
+    request[length] = 0;
+    if (strstr(request, "\r\n\r\n")) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void serveConnection(Server *server, int fd) {
+  char request[REQUEST_BYTES];
+  if (!readRequest(fd, request)) {
+    return;
+  }
+  atomic_fetch_add(&server->requests, 1);
+  int level;
+  long long x, y;
+  int end = 0;
+  if (!strncmp(request, "GET /stats ", 11)) {
+    char body[256];
+    int length = snprintf(
+        body, sizeof(body),
+        "{\"requests\": %ld, \"rendered\": %ld, \"coalesced\": %ld, "
+        "\"failed\": %ld}\n",
+        atomic_load(&server->requests), atomic_load(&server->rendered),
+        atomic_load(&server->coalesced), atomic_load(&server->failed));
+    sendResponse(fd, "200 OK", "application/json", body, length);
+    return;
+  }
+  if (sscanf(request, "GET /%d/%lld/%lld.png %n", &level, &x, &y, &end) != 3 ||
+      !end || level < 0 || level > MAX_LEVEL || x < 0 || y < 0 ||
+      x >= 1LL << level || y >= 1LL << level) {
+    static const char notFound[] = "not found\n";
+    sendResponse(fd, "404 Not Found", "text/plain", notFound,
+                 sizeof(notFound) - 1);
+    return;
+  }
+  Flight *flight = acquireTile(server, level, x, y);
+  if (!flight || !flight->png.data) {
+    atomic_fetch_add(&server->failed, 1);
+    static const char failed[] = "out of memory\n";
+    sendResponse(fd, "500 Internal Server Error", "text/plain", failed,
+                 sizeof(failed) - 1);
+  } else {
+    sendResponse(fd, "200 OK", "image/png", flight->png.data,
+                 flight->png.length);
+  }
+  if (flight) {
+    releaseTile(server, flight);
+  }
+}
+
+static void *workerThread(void *argument) {
+  Server *server = argument;
+  for (;;) {
+    int fd = accept(server->listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        // Out of descriptors (EMFILE, ENFILE) or worse: trying again straight
+        // away would just spin, so give the other connections a moment to
+        // close theirs
+        perror("accept");
+        struct timespec pause = {0, 10000000};
+        nanosleep(&pause, NULL);
+      }
+      continue;
+    }
+    // (So a client that never finishes its request can't hold on to a worker)
+    struct timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    serveConnection(server, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+static int serve(Server *server, int port, int connections, int threads) {
+  server->listener = socket(AF_INET, SOCK_STREAM, 0);
+  int yes = 1;
+  setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  struct sockaddr_in address = {.sin_family = AF_INET,
+                                .sin_port = htons(port),
+                                .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  if (server->listener < 0 ||
+      bind(server->listener, (struct sockaddr *)&address, sizeof(address)) ||
+      listen(server->listener, 1024)) {
+    perror("can't listen");
+    return 1;
+  }
+  pthread_mutex_init(&server->lock, NULL);
+  pthread_cond_init(&server->finished, NULL);
+  pthread_cond_init(&server->renderFreed, NULL);
+  // The palette table and the kernels are set up on first use, so that
+  // happens here rather than in every worker at once
+  float iters[2] = {0};
+  uint32_t color;
+  run(server->type, 1, 1, 0, 0, 0, 1, INT_MAX, iters, &color,
+      server->iterations, serverPallete, 12, 0xff000000, 0,
+      server->darkenEffect, 1.0f, 0);
+
+  server->idle = calloc(threads, sizeof(Renderer));
+  if (!server->idle) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for (int k = 0; k < threads; k++) {
+    server->idle[k] = (Renderer){
+        .iters = malloc(sizeof(float) * 2 * TILE_SIZE * TILE_SIZE),
+        .colors = malloc(sizeof(uint32_t) * TILE_SIZE * TILE_SIZE)};
+    if (!server->idle[k].iters || !server->idle[k].colors) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+  }
+  server->idleCount = threads;
+  for (int k = 0; k < connections; k++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, workerThread, server)) {
+      fprintf(stderr, "can't start the workers\n");
+      return 1;
+    }
+  }
+  fprintf(stderr,
+          "serving tiles on http://127.0.0.1:%d/{z}/{x}/{y}.png with %d "
+          "workers, %d rendering at once%s\n",
+          port, connections, threads,
+          server->coalesce ? "" : " (not coalescing)");
+  pause();
+  return 0;
+}
+
+// -----
+
+// The load generator. Every client keeps picking one of the popular places
+// (the first ones far more often) and a level, and fetches the screen of
+// tiles around it one after another, like a map being opened there.
+
+// Where people go, and how far in
+static const double places[][2] = {{-0.75, 0.1},
+                                   {-0.743643887037151, 0.131825904205330},
+                                   {-1.25066, 0.02012},
+                                   {0.285, 0.01},
+                                   {-0.1011, 0.9563},
+                                   {-1.768778833, -0.001738996}};
+#define PLACES (int)(sizeof(places) / sizeof(places[0]))
+#define LOAD_LEVELS 8
+// A screen of tiles
+#define SCREEN_TILES 3
+
+typedef struct {
+  struct sockaddr_in address;
+  atomic_long next;
+  long total;
+  atomic_long failed;
+  atomic_long bytes;
+  // Latencies in microseconds, one per request
+  float *latencies;
+} Load;
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// The largest response the load generator expects (a tile is at most about
+// 200 KB)
+#define RESPONSE_BYTES (1 << 20)
+
+// GET path into response (RESPONSE_BYTES long). Returns the length of the
+// body, which *body is set to point at, or -1 if the request failed.
+static long fetch(const struct sockaddr_in *address, const char *path,
+                  char *response, char **body) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, (const struct sockaddr *)address, sizeof(*address))) {
+    close(fd);
+    return -1;
+  }
+  char request[256];
+  int length = snprintf(request, sizeof(request),
+                        "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+  size_t got = 0;
+  ssize_t read = -1;
+  if (sendAll(fd, request, length)) {
+    while (got < RESPONSE_BYTES - 1 &&
+           (read = recv(fd, response + got, RESPONSE_BYTES - 1 - got, 0)) > 0) {
+      got += read;
+    }
+  }
+  close(fd);
+  response[got] = 0;
+  char *start = strstr(response, "\r\n\r\n");
+  if (read || !start || strncmp(response, "HTTP/1.1 200", 12)) {
+    return -1;
+  }
+  *body = start + 4;
+  return got - (*body - response);
+}
+
+static void *clientThread(void *argument) {
+  Load *load = argument;
+  char *response = malloc(RESPONSE_BYTES);
+  char *body;
+  unsigned seed = (unsigned)(uintptr_t)&seed ^ (unsigned)time(NULL);
+  for (;;) {
+    // Places are picked with a falling chance (about 1/2, 1/4, ...) and
+    // levels evenly
+    int place = 0;
+    while (place < PLACES - 1 && rand_r(&seed) % 2) {
+      place++;
+    }
+    int level = 2 + rand_r(&seed) % LOAD_LEVELS;
+    double tileWidth = ldexp(WORLD_SIZE, -level);
+    int64_t centerX = (places[place][0] - WORLD_LEFT) / tileWidth;
+    int64_t centerY = (places[place][1] - WORLD_TOP) / tileWidth;
+    for (int k = 0; k < SCREEN_TILES * SCREEN_TILES; k++) {
+      long request = atomic_fetch_add(&load->next, 1);
+      if (request >= load->total) {
+        free(response);
+        return NULL;
+      }
+      int64_t x = centerX + k % SCREEN_TILES - SCREEN_TILES / 2;
+      int64_t y = centerY + k / SCREEN_TILES - SCREEN_TILES / 2;
+      int64_t last = (1LL << level) - 1;
+      x = x < 0 ? 0 : x > last ? last : x;
+      y = y < 0 ? 0 : y > last ? last : y;
+      char path[64];
+      snprintf(path, sizeof(path), "/%d/%lld/%lld.png", level, (long long)x,
+               (long long)y);
+      double started = now();
+      long length =
+          response ? fetch(&load->address, path, response, &body) : -1;
+      load->latencies[request] = (now() - started) * 1e6;
+      if (length < 0) {
+        atomic_fetch_add(&load->failed, 1);
+      } else {
+        atomic_fetch_add(&load->bytes, length);
+      }
+    }
+  }
+}
+
+static int compareFloats(const void *a, const void *b) {
+  float x = *(const float *)a;
+  float y = *(const float *)b;
+  return (x > y) - (x < y);
+}
+
+static int generateLoad(const char *target, int clients, long requests) {
+  Load load = {.total = requests,
+               .latencies = calloc(requests, sizeof(float))};
+  char host[64];
+  int port;
+  if (sscanf(target, "%63[^:]:%d", host, &port) != 2 ||
+      inet_pton(AF_INET, host, &load.address.sin_addr) != 1) {
+    fprintf(stderr, "--load wants an address like 127.0.0.1:8080\n");
+    return 2;
+  }
+  load.address.sin_family = AF_INET;
+  load.address.sin_port = htons(port);
+  pthread_t *threads = calloc(clients, sizeof(pthread_t));
+  if (!load.latencies || !threads) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  char *response = malloc(RESPONSE_BYTES);
+  char *body;
+  char before[256] = "";
+  if (response && fetch(&load.address, "/stats", response, &body) >= 0) {
+    snprintf(before, sizeof(before), "%s", body);
+  }
+  double started = now();
+  for (int k = 0; k < clients; k++) {
+    if (pthread_create(&threads[k], NULL, clientThread, &load)) {
+      fprintf(stderr, "can't start the clients\n");
+      return 1;
+    }
+  }
+  for (int k = 0; k < clients; k++) {
+    pthread_join(threads[k], NULL);
+  }
+  double seconds = now() - started;
+  char after[256] = "";
+  if (response && fetch(&load.address, "/stats", response, &body) >= 0) {
+    snprintf(after, sizeof(after), "%s", body);
+  }
+
+  qsort(load.latencies, requests, sizeof(float), compareFloats);
+  printf("%ld requests from %d clients in %.2f s: %.0f requests/s, %.1f MB/s, "
+         "%ld failed\n",
+         requests, clients, seconds, requests / seconds,
+         atomic_load(&load.bytes) / seconds / 1e6, atomic_load(&load.failed));
+  printf("latency: median %.1f ms, 90%% %.1f ms, 99%% %.1f ms, max %.1f ms\n",
+         load.latencies[requests / 2] / 1e3,
+         load.latencies[requests * 9 / 10] / 1e3,
+         load.latencies[requests * 99 / 100] / 1e3,
+         load.latencies[requests - 1] / 1e3);
+  printf("server before: %sserver after:  %s", before, after);
+  free(response);
+  free(threads);
+  free(load.latencies);
+  return atomic_load(&load.failed) ? 1 : 0;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: fractal_server [--port N] [--connections N] [--threads N]\n"
+          "                      [--type N] [--iterations N] [--darken N]\n"
+          "                      [--level N] [--no-coalesce]\n"
+          "       fractal_server --load HOST:PORT [--clients N] "
+          "[--requests N]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  Server server = {.iterations = 1000,
+                   .compression = Z_BEST_SPEED,
+                   .coalesce = 1};
+  int port = 8080;
+  int connections = 64;
+  int threads = 0;
+  const char *target = NULL;
+  int clients = 64;
+  long requests = 20000;
+  for (int k = 1; k < argc; k++) {
+    if (!strcmp(argv[k], "--no-coalesce")) {
+      server.coalesce = 0;
+      continue;
+    }
+    if (k + 1 == argc) {
+      usage();
+    }
+    if (!strcmp(argv[k], "--port")) {
+      port = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--connections")) {
+      connections = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--threads")) {
+      threads = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--type")) {
+      server.type = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--iterations")) {
+      server.iterations = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--darken")) {
+      server.darkenEffect = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--level")) {
+      server.compression = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--load")) {
+      target = argv[++k];
+    } else if (!strcmp(argv[k], "--clients")) {
+      clients = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "--requests")) {
+      requests = atol(argv[++k]);
+    } else {
+      usage();
+    }
+  }
+  if (target) {
+    if (clients < 1 || requests < 1) {
+      usage();
+    }
+    return generateLoad(target, clients, requests);
+  }
+  if (port < 1 || port > 65535 || connections < 1 || server.type < 0 ||
+      server.type > 15 || server.iterations < 1 || server.darkenEffect < 0 ||
+      server.darkenEffect > 3 || server.compression < 0 ||
+      server.compression > 9) {
+    usage();
+  }
+  if (threads < 1) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  return serve(&server, port, connections, threads);
+}